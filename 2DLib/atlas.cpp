@@ -0,0 +1,495 @@
+/* --------------------------------------------------------------------------
+
+atlas.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Packing sprites into a texture atlas.
+
+-----------------------------------------------------------------------------*/
+
+#include "atlas.h"
+#include "blit.h"
+#include "dedup.h"
+#include "orientation.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+struct Box
+{
+	int x, y, w, h;
+};
+
+// MaxRects: keeps every maximal free rectangle, places each rect where it
+// leaves the shortest leftover side, then splits the free rectangles it
+// overlaps and drops those inside others.
+class MaxRects
+{
+	std::vector<Box> free;
+
+	static bool Contains(const Box &a, const Box &b)
+	{
+		return b.x >= a.x && b.y >= a.y && b.x + b.w <= a.x + a.w && b.y + b.h <= a.y + a.h;
+	}
+
+	void Split(const Box &used)
+	{
+		std::vector<Box> next;
+
+		for (const Box &f : free)
+		{
+			if (used.x >= f.x + f.w || used.x + used.w <= f.x || used.y >= f.y + f.h || used.y + used.h <= f.y)
+			{
+				next.push_back(f);
+				continue;
+			}
+
+			if (used.x > f.x)
+				next.push_back(Box{ f.x, f.y, used.x - f.x, f.h });
+
+			if (used.x + used.w < f.x + f.w)
+				next.push_back(Box{ used.x + used.w, f.y, f.x + f.w - used.x - used.w, f.h });
+
+			if (used.y > f.y)
+				next.push_back(Box{ f.x, f.y, f.w, used.y - f.y });
+
+			if (used.y + used.h < f.y + f.h)
+				next.push_back(Box{ f.x, used.y + used.h, f.w, f.y + f.h - used.y - used.h });
+		}
+
+		free.clear();
+
+		for (size_t i = 0; i < next.size(); i++)
+		{
+			bool inside = false;
+
+			for (size_t j = 0; j < next.size() && !inside; j++)
+			{
+				// Of two equal rectangles, keep the first.
+				inside = (i != j) && Contains(next[j], next[i]) && !(j > i && Contains(next[i], next[j]));
+			}
+
+			if (!inside)
+				free.push_back(next[i]);
+		}
+	}
+
+public:
+
+	MaxRects(int w, int h)
+	{
+		free.push_back(Box{ 0, 0, w, h });
+	}
+
+	bool Insert(int w, int h, bool rotate, Box &out, bool &rotated)
+	{
+		int best_short = INT_MAX, best_long = INT_MAX;
+
+		for (const Box &f : free)
+		{
+			for (int turn = 0; turn < ((rotate) ? 2 : 1); turn++)
+			{
+				int rw = (turn) ? h : w, rh = (turn) ? w : h;
+
+				if (rw > f.w || rh > f.h)
+					continue;
+
+				int s = std::min(f.w - rw, f.h - rh), l = std::max(f.w - rw, f.h - rh);
+
+				if (s < best_short || (s == best_short && l < best_long))
+				{
+					best_short = s;
+					best_long = l;
+					out = Box{ f.x, f.y, rw, rh };
+					rotated = (turn != 0);
+				}
+			}
+		}
+
+		if (best_short == INT_MAX)
+			return false;
+
+		Split(out);
+		return true;
+	}
+};
+
+// Skyline: the top of what is packed so far, as segments.  Each rect goes
+// where its bottom ends up lowest, then leftmost.
+class Skyline
+{
+	struct Segment
+	{
+		int x, y, w;
+	};
+
+	std::vector<Segment> line;
+	int width, height;
+
+	// Lowest y a rect of width w fits at starting on segment i, or -1.
+	int Fit(size_t i, int w) const
+	{
+		if (line[i].x + w > width)
+			return -1;
+
+		int y = 0, left = w;
+
+		for (; left > 0 && i < line.size(); i++)
+		{
+			y = std::max(y, line[i].y);
+			left -= line[i].w;
+		}
+
+		return y;
+	}
+
+public:
+
+	Skyline(int w, int h)
+		: width(w)
+		, height(h)
+	{
+		line.push_back(Segment{ 0, 0, w });
+	}
+
+	bool Insert(int w, int h, bool rotate, Box &out, bool &rotated)
+	{
+		int best_bottom = INT_MAX, best_x = INT_MAX;
+
+		for (size_t i = 0; i < line.size(); i++)
+		{
+			for (int turn = 0; turn < ((rotate) ? 2 : 1); turn++)
+			{
+				int rw = (turn) ? h : w, rh = (turn) ? w : h;
+				int y = Fit(i, rw);
+
+				if (y < 0 || y + rh > height)
+					continue;
+
+				if (y + rh < best_bottom || (y + rh == best_bottom && line[i].x < best_x))
+				{
+					best_bottom = y + rh;
+					best_x = line[i].x;
+					out = Box{ line[i].x, y, rw, rh };
+					rotated = (turn != 0);
+				}
+			}
+		}
+
+		if (best_bottom == INT_MAX)
+			return false;
+
+		// Raise the line under the rect.
+		std::vector<Segment> next;
+		Segment top = { out.x, out.y + out.h, out.w };
+		bool added = false;
+
+		for (const Segment &s : line)
+		{
+			if (s.x + s.w <= out.x || s.x >= out.x + out.w)
+			{
+				if (s.x >= out.x + out.w && !added)
+				{
+					next.push_back(top);
+					added = true;
+				}
+
+				next.push_back(s);
+				continue;
+			}
+
+			if (s.x < out.x)
+				next.push_back(Segment{ s.x, s.y, out.x - s.x });
+
+			if (!added)
+			{
+				next.push_back(top);
+				added = true;
+			}
+
+			if (s.x + s.w > out.x + out.w)
+				next.push_back(Segment{ out.x + out.w, s.y, s.x + s.w - out.x - out.w });
+		}
+
+		if (!added)
+			next.push_back(top);
+
+		// Join neighbors at the same height.
+		line.clear();
+
+		for (const Segment &s : next)
+		{
+			if (!line.empty() && line.back().y == s.y)
+				line.back().w += s.w;
+			else
+				line.push_back(s);
+		}
+
+		return true;
+	}
+};
+
+template <class Bin>
+static bool PackWith(const std::vector<Size> &sizes, const std::vector<size_t> &order, const Size &bin, const Atlas::Options &opt, std::vector<Atlas::Placement> &placements)
+{
+	int grow = opt.extrude * 2 + opt.padding;
+	bool all = true;
+
+	// The padding right and below the last sprites may go past the edges.
+	Bin packer(bin.W + opt.padding, bin.H + opt.padding);
+
+	for (size_t i : order)
+	{
+		Atlas::Placement &p = placements[i];
+		p.rotated = false;
+		p.original = -1;
+
+		if (sizes[i].W <= 0 || sizes[i].H <= 0)
+		{
+			p.placed = true;
+			p.dest = Rect(Point(0, 0), Size(0, 0));
+			continue;
+		}
+
+		Box box;
+		p.placed = packer.Insert(sizes[i].W + grow, sizes[i].H + grow, opt.rotate, box, p.rotated);
+
+		if (!p.placed)
+		{
+			all = false;
+			continue;
+		}
+
+		Size s = (p.rotated) ? Size(sizes[i].H, sizes[i].W) : sizes[i];
+		p.dest = Rect(Point(box.x + opt.extrude, box.y + opt.extrude), s);
+	}
+
+	return all;
+}
+
+bool Atlas::Pack(const std::vector<Size> &sizes, const Size &bin, const Options &opt, std::vector<Placement> &placements)
+{
+	std::vector<size_t> order(sizes.size());
+
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+
+	// Largest side first, then largest area.
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		int ma = std::max(sizes[a].W, sizes[a].H), mb = std::max(sizes[b].W, sizes[b].H);
+		return (ma != mb) ? ma > mb : sizes[a].W * sizes[a].H > sizes[b].W * sizes[b].H;
+	});
+
+	placements.resize(sizes.size());
+
+	if (opt.method == SKYLINE)
+		return PackWith<Skyline>(sizes, order, bin, opt, placements);
+
+	return PackWith<MaxRects>(sizes, order, bin, opt, placements);
+}
+
+// Atlas sizes to try, smallest area first.
+static std::vector<Size> Candidates(const std::vector<Size> &sizes, const Atlas::Options &opt)
+{
+	std::vector<Size> out;
+
+	if (opt.fixed)
+	{
+		out.push_back(opt.max_size);
+		return out;
+	}
+
+	int grow = opt.extrude * 2 + opt.padding;
+	double area = 0;
+
+	for (const Size &s : sizes)
+	{
+		if (s.W > 0 && s.H > 0)
+			area += (double)(s.W + grow) * (s.H + grow);
+	}
+
+	if (opt.power_of_two)
+	{
+		for (int w = 1; w <= opt.max_size.W; w *= 2)
+		{
+			for (int h = 1; h <= opt.max_size.H; h *= 2)
+			{
+				if ((double)w * h >= area)
+					out.push_back(Size(w, h));
+			}
+		}
+
+		// Smallest first, then squarest, then wider.
+		std::sort(out.begin(), out.end(), [](const Size &a, const Size &b) {
+			double aa = (double)a.W * a.H, ab = (double)b.W * b.H;
+
+			if (aa != ab)
+				return aa < ab;
+
+			if (std::abs(a.W - a.H) != std::abs(b.W - b.H))
+				return std::abs(a.W - a.H) < std::abs(b.W - b.H);
+
+			return a.W > b.W;
+		});
+
+		return out;
+	}
+
+	int side = std::max(1, (int)std::ceil(std::sqrt(area)));
+	int w = std::min(side, opt.max_size.W), h = std::min(side, opt.max_size.H);
+
+	for (;;)
+	{
+		out.push_back(Size(w, h));
+
+		if (w >= opt.max_size.W && h >= opt.max_size.H)
+			break;
+
+		int step = std::max(1, std::max(w, h) / 32);
+
+		if ((w <= h && w < opt.max_size.W) || h >= opt.max_size.H)
+			w = std::min(opt.max_size.W, w + step);
+		else
+			h = std::min(opt.max_size.H, h + step);
+	}
+
+	return out;
+}
+
+// Copies the source rect of a sprite at dest in the atlas, turned 90
+// degrees clockwise if rotated, in the atlas's alpha mode.  Done on views
+// rather than with CopyRectFromBuffer so sprites can be copied in parallel.
+static void CopySprite(const Buffer &sprite, const Atlas::Placement &p, Buffer &atlas)
+{
+	BufferView to(atlas, p.dest);
+
+	if (p.rotated)
+		Orientation::Apply(to, BufferView(sprite, p.source), Orientation::ROTATE_90);
+	else
+		Blit::Copy(to, BufferView(sprite, p.source));
+
+	if (sprite.IsPremultiplied() != atlas.IsPremultiplied())
+	{
+		if (atlas.IsPremultiplied())
+			Composite::Premultiply(to);
+		else
+			Composite::Unpremultiply(to);
+	}
+}
+
+// Repeats the border pixels of dest outward by n.
+static void Extrude(const Rect &d, int n, Buffer &atlas)
+{
+	size_t bpp = Format::BytesPerPixel(atlas.GetFormat());
+	unsigned char *bits = atlas.GetBits();
+	int w = atlas.GetSize().W;
+
+	auto at = [&](int x, int y) { return bits + ((size_t)y * w + x) * bpp; };
+
+	for (int y = d.top; y <= d.bottom; y++)
+	{
+		for (int i = 1; i <= n; i++)
+		{
+			memcpy(at(d.left - i, y), at(d.left, y), bpp);
+			memcpy(at(d.right + i, y), at(d.right, y), bpp);
+		}
+	}
+
+	size_t row = (d.GetWidth() + 2 * n) * bpp;
+
+	for (int i = 1; i <= n; i++)
+	{
+		memcpy(at(d.left - n, d.top - i), at(d.left - n, d.top), row);
+		memcpy(at(d.left - n, d.bottom + i), at(d.left - n, d.bottom), row);
+	}
+}
+
+bool Atlas::Build(const std::vector<const Buffer *> &sprites, const Options &opt, Buffer &atlas, std::vector<Placement> &placements)
+{
+	std::vector<Rect> sources(sprites.size());
+	std::vector<Size> sizes(sprites.size());
+
+	ThreadPool::Shared().For((int)sprites.size(), [&](int i) {
+		Rect whole(Point(0, 0), sprites[i]->GetSize());
+		sources[i] = (opt.trim) ? sprites[i]->Trim(whole, opt.content) : whole;
+		sizes[i] = Size(sources[i].GetWidth(), sources[i].GetHeight());
+	});
+
+	// Duplicates are not packed, and take the slot of the first of their kind.
+	std::vector<int> original(sprites.size(), -1);
+
+	if (opt.dedup)
+	{
+		std::vector<unsigned long long> hashes(sprites.size());
+
+		ThreadPool::Shared().For((int)sprites.size(), [&](int i) { hashes[i] = sprites[i]->Hash(sources[i]); });
+
+		DedupIndex index;
+
+		for (size_t i = 0; i < sprites.size(); i++)
+		{
+			size_t first = index.Add(*sprites[i], sources[i], hashes[i]);
+
+			if (first != i && sizes[i].W > 0 && sizes[i].H > 0)
+			{
+				original[i] = (int)first;
+				sizes[i] = Size(0, 0);
+			}
+		}
+	}
+
+	bool all = false;
+	Size bin = opt.max_size;
+
+	for (const Size &s : Candidates(sizes, opt))
+	{
+		bin = s;
+
+		if ((all = Pack(sizes, bin, opt, placements)) == true)
+			break;
+	}
+
+	// Nothing big enough: place what fits in the largest.
+	if (!all)
+	{
+		bin = opt.max_size;
+		all = Pack(sizes, bin, opt, placements);
+	}
+
+	atlas.Reset(bin, RGBA::NoAlpha);
+
+	for (size_t i = 0; i < sprites.size(); i++)
+	{
+		if (original[i] >= 0)
+		{
+			placements[i] = placements[original[i]];
+			placements[i].original = original[i];
+		}
+
+		placements[i].source = sources[i];
+	}
+
+	// Sprites never overlap in the atlas, so they are copied in parallel.
+	ThreadPool::Shared().For((int)sprites.size(), [&](int i) {
+		const Placement &p = placements[i];
+
+		if (!p.placed || p.original >= 0 || p.dest.GetWidth() <= 0)
+			return;
+
+		CopySprite(*sprites[i], p, atlas);
+
+		if (opt.extrude > 0)
+			Extrude(p.dest, opt.extrude, atlas);
+	});
+
+	atlas.Touched(Rect(Point(0, 0), bin));
+
+	return all;
+}
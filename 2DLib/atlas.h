@@ -0,0 +1,80 @@
+/* --------------------------------------------------------------------------
+
+atlas.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Packing sprites into a texture atlas.
+
+Sprites are trimmed to their content, their rects packed with MaxRects
+(best short side fit) or a bottom-left skyline, largest first, then copied
+into the atlas in parallel.  Unless the size is fixed, the smallest atlas
+everything fits in is searched for, up to max_size.
+
+Sprites whose trimmed pixels are identical are packed and copied once.
+
+Padding is left empty between sprites; extrusion repeats the border pixels
+of each sprite outward, inside that sprite's own space, so filtering at the
+edges doesn't pick up the neighbors.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include "buffer.h"
+
+namespace Atlas
+{
+	enum Method { MAXRECTS, SKYLINE };
+
+	struct Options
+	{
+		Method method;
+		bool rotate;			// Allow turning sprites 90 degrees clockwise.
+		int padding;			// Empty pixels between sprites.
+		int extrude;			// Border pixels repeated around each sprite.
+		bool power_of_two;		// Width and height are powers of two.
+		bool fixed;				// Use max_size as is.
+		Size max_size;
+		bool trim;
+		Mask content;			// What trimming keeps.
+		bool dedup;				// Sprites with the same pixels share one slot.
+
+		Options()
+			: method(MAXRECTS)
+			, rotate(false)
+			, padding(0)
+			, extrude(0)
+			, power_of_two(false)
+			, fixed(false)
+			, max_size(4096, 4096)
+			, trim(true)
+			, content(Mask::AlphaAbove(0.f))
+			, dedup(true)
+		{
+
+		}
+	};
+
+	struct Placement
+	{
+		bool placed;
+		Rect source;		// Part of the sprite that was packed.
+		Rect dest;			// Where it went in the atlas, turned if rotated.
+		bool rotated;
+		int original;		// Sprite whose slot this one shares, or -1.
+	};
+
+	// Packs sizes into a bin of the given size, largest first.  placements
+	// get the packed rects (placed, dest, rotated); returns whether all fit.
+	bool Pack(const std::vector<Size> &sizes, const Size &bin, const Options &opt, std::vector<Placement> &placements);
+
+	// Builds atlas, in its current format and alpha mode, from the sprites.  placements[i]
+	// tells where sprites[i] went.  Returns whether all fit.
+	bool Build(const std::vector<const Buffer *> &sprites, const Options &opt, Buffer &atlas, std::vector<Placement> &placements);
+};
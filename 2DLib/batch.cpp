@@ -0,0 +1,108 @@
+/* --------------------------------------------------------------------------
+
+batch.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Loading and saving lists of files over a ThreadPool.
+
+-----------------------------------------------------------------------------*/
+
+#include "batch.h"
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+
+// Runs job(i) for every file over the pool, with at most max_in_flight at a
+// time, and turns what each returns or throws into its Result.
+static std::vector<Batch::Result> Run(size_t n, const std::function<bool(size_t)> &job, int max_in_flight, ThreadPool &pool)
+{
+	std::vector<Batch::Result> results(n);
+
+	if (max_in_flight <= 0)
+		max_in_flight = pool.GetSize() * 2;
+
+	std::mutex mutex;
+	std::condition_variable slot;
+	int running = 0;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			slot.wait(lock, [&]() { return running < max_in_flight; });
+			running++;
+		}
+
+		pool.Post([&, i]() {
+			Batch::Result &r = results[i];
+
+			try
+			{
+				r.ok = job(i);
+
+				if (!r.ok)
+					r.error = "Unsupported or unreadable file";
+			}
+			catch (PNG_Exception &e)
+			{
+				r.error = e.GetError();
+			}
+			catch (std::exception &e)
+			{
+				r.error = e.what();
+			}
+			catch (...)
+			{
+				r.error = "Unknown error";
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			running--;
+			slot.notify_all();
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	slot.wait(lock, [&]() { return running == 0; });
+
+	return results;
+}
+
+std::vector<Batch::Result> Batch::Load(const std::vector<std::string> &files, PixelFormat pf,
+	const std::function<void(size_t, Buffer &)> &done, int max_in_flight, ThreadPool &pool)
+{
+	return Run(files.size(), [&](size_t i) {
+		Buffer b(pf);
+
+		if (!b.Load(files[i]))
+			return false;
+
+		done(i, b);
+		return true;
+	}, max_in_flight, pool);
+}
+
+std::vector<Batch::Result> Batch::Load(const std::vector<std::string> &files, std::vector<Buffer> &buffers, PixelFormat pf, ThreadPool &pool)
+{
+	buffers.clear();
+	buffers.resize(files.size(), Buffer(pf));
+
+	return Run(files.size(), [&](size_t i) { return buffers[i].Load(files[i]); }, 0, pool);
+}
+
+std::vector<Batch::Result> Batch::Save(const std::vector<std::string> &files, const std::function<Buffer(size_t)> &make,
+	bool with_alpha, bool compress, int max_in_flight, ThreadPool &pool)
+{
+	return Run(files.size(), [&](size_t i) { return make(i).Save(files[i], with_alpha, compress); }, max_in_flight, pool);
+}
+
+std::vector<Batch::Result> Batch::Save(const std::vector<std::string> &files, const std::vector<Buffer> &buffers,
+	bool with_alpha, bool compress, ThreadPool &pool)
+{
+	return Run(files.size(), [&](size_t i) { return buffers[i].Save(files[i], with_alpha, compress); }, 0, pool);
+}
@@ -0,0 +1,55 @@
+/* --------------------------------------------------------------------------
+
+batch.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Loading and saving lists of files over a ThreadPool.
+
+At most max_in_flight files are being worked on at once (0 means twice the
+pool's size), so the streaming versions keep memory bounded however long
+the list is.  Each file gets its own Result; a failure does not stop the
+others.  Don't call these from a task of the same pool.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "buffer.h"
+#include "threadpool.h"
+
+namespace Batch
+{
+	struct Result
+	{
+		bool ok;
+		std::string error;
+
+		Result() : ok(false) { }
+	};
+
+	// Loads files[i] in format pf and hands it to done(i, buffer) on a worker
+	// thread.  The buffer is gone once done returns; move it out to keep it.
+	std::vector<Result> Load(const std::vector<std::string> &files, PixelFormat pf,
+		const std::function<void(size_t, Buffer &)> &done, int max_in_flight = 0, ThreadPool &pool = ThreadPool::Shared());
+
+	// Loads every file, buffers[i] holding files[i].
+	std::vector<Result> Load(const std::vector<std::string> &files, std::vector<Buffer> &buffers, PixelFormat pf = RGBA32F,
+		ThreadPool &pool = ThreadPool::Shared());
+
+	// Saves the buffer make(i) returns as files[i].  make is called on a worker
+	// thread, so buffers are produced no faster than they are written.
+	std::vector<Result> Save(const std::vector<std::string> &files, const std::function<Buffer(size_t)> &make,
+		bool with_alpha = true, bool compress = false, int max_in_flight = 0, ThreadPool &pool = ThreadPool::Shared());
+
+	// Saves buffers[i] as files[i].
+	std::vector<Result> Save(const std::vector<std::string> &files, const std::vector<Buffer> &buffers,
+		bool with_alpha = true, bool compress = false, ThreadPool &pool = ThreadPool::Shared());
+};
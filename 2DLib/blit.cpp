@@ -0,0 +1,134 @@
+/* --------------------------------------------------------------------------
+
+blit.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Copying rectangles of pixels between buffers and views.
+
+-----------------------------------------------------------------------------*/
+
+#include "blit.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Copies at least this many bytes are split in bands of rows over the pool.
+static const size_t PARALLEL_BYTES = 1 << 22;
+static const int BAND_ROWS = 32;
+
+// Clips one axis of both rects, moving their starts together.
+static bool ClipAxis(int& dst_start, int dst_end, int dst_limit, int& src_start, int src_end, int src_limit, int& length)
+{
+	length = std::min(dst_end - dst_start, src_end - src_start) + 1;
+
+	int k = std::max(0, std::max(-dst_start, -src_start));
+	dst_start += k;
+	src_start += k;
+	length -= k;
+
+	length = std::min(length, std::min(dst_limit - dst_start, src_limit - src_start));
+
+	return length > 0;
+}
+
+bool Blit::Clip(Rect& dst, const Size& dst_size, Rect& src, const Size& src_size)
+{
+	int w, h;
+
+	if (!ClipAxis(dst.left, dst.right, dst_size.W, src.left, src.right, src_size.W, w) ||
+		!ClipAxis(dst.top, dst.bottom, dst_size.H, src.top, src.bottom, src_size.H, h))
+		return false;
+
+	dst.right = dst.left + w - 1;
+	dst.bottom = dst.top + h - 1;
+	src.right = src.left + w - 1;
+	src.bottom = src.top + h - 1;
+
+	return true;
+}
+
+void Blit::Row(void *dst, PixelFormat d, const void *src, PixelFormat s, size_t n)
+{
+	if (s == d)
+	{
+		memmove(dst, src, n * Format::BytesPerPixel(s));
+		return;
+	}
+
+	const unsigned char *a = (const unsigned char *)src, *b = (const unsigned char *)dst;
+
+	if (a < b + n * Format::BytesPerPixel(d) && b < a + n * Format::BytesPerPixel(s))
+	{
+		std::vector<unsigned char> copy(a, a + n * Format::BytesPerPixel(s));
+		Format::ConvertRow(s, copy.data(), d, dst, n);
+		return;
+	}
+
+	Format::ConvertRow(s, src, d, dst, n);
+}
+
+void Blit::Copy(const BufferView& dst, const BufferView& src)
+{
+	int w = std::min(dst.GetSize().W, src.GetSize().W);
+	int h = std::min(dst.GetSize().H, src.GetSize().H);
+
+	if (w <= 0 || h <= 0)
+		return;
+
+	PixelFormat d = dst.GetFormat(), s = src.GetFormat();
+	size_t dst_row = w * Format::BytesPerPixel(d), src_row = w * Format::BytesPerPixel(s);
+
+	const unsigned char *dst_begin = dst.Row(0), *dst_end = dst.Row(h - 1) + dst_row;
+	const unsigned char *src_begin = src.Row(0), *src_end = src.Row(h - 1) + src_row;
+
+	if (dst_begin < src_end && src_begin < dst_end)
+	{
+		if (s != d || dst.GetStride() != src.GetStride())
+		{
+			// Rows don't line up with the source; work from a copy.
+			std::vector<unsigned char> copy(src_row * h);
+
+			for (int y = 0; y < h; y++)
+				memcpy(&copy[y * src_row], src.Row(y), src_row);
+
+			Copy(dst, BufferView(copy.data(), Size(w, h), s));
+			return;
+		}
+
+		// Same pixels: when moving down, copy from the bottom so rows are
+		// read before they are overwritten.  memmove handles each row.
+		if (dst_begin > src_begin)
+		{
+			for (int y = h - 1; y >= 0; y--)
+				memmove(dst.Row(y), src.Row(y), dst_row);
+		}
+		else
+		{
+			for (int y = 0; y < h; y++)
+				memmove(dst.Row(y), src.Row(y), dst_row);
+		}
+
+		return;
+	}
+
+	auto band = [&](int i) {
+		for (int y = i * BAND_ROWS; y < std::min(h, (i + 1) * BAND_ROWS); y++)
+			Format::ConvertRow(s, src.Row(y), d, dst.Row(y), w);
+	};
+
+	int bands = (h + BAND_ROWS - 1) / BAND_ROWS;
+
+	if (bands > 1 && std::max(dst_row, src_row) * h >= PARALLEL_BYTES)
+		ThreadPool::Shared().For(bands, band);
+	else
+	{
+		for (int i = 0; i < bands; i++)
+			band(i);
+	}
+}
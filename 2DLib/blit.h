@@ -0,0 +1,37 @@
+/* --------------------------------------------------------------------------
+
+blit.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Copying rectangles of pixels between buffers and views.
+
+Both rects are clipped first, so a copy never goes outside either image.
+Rows of the same format are moved with memmove and other formats go through
+the bulk row converters.  Source and destination can be the same pixels:
+rows are copied in the order that keeps the source intact.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "bufferview.h"
+
+namespace Blit
+{
+	// Clips dst to an image of dst_size and src to one of src_size, moving
+	// the other rect along, and makes both the size of the smaller one.
+	// Returns false when nothing is left to copy.
+	bool Clip(Rect& dst, const Size& dst_size, Rect& src, const Size& src_size);
+
+	// Copies n pixels from src in format s to dst in format d.  The two rows
+	// may overlap.
+	void Row(void *dst, PixelFormat d, const void *src, PixelFormat s, size_t n);
+
+	// Copies src into dst from the top left corner, as far as both go.
+	void Copy(const BufferView& dst, const BufferView& src);
+};
@@ -26,18 +26,143 @@ Buffer class in which we manipulate the color data.
 
 -----------------------------------------------------------------------------*/
 #include "buffer.h"
+#include "blit.h"
+#include "bufferview.h"
+#include "pixelops.h"
+#include "resample.h"
+#include "stats.h"
+#include "hash.h"
+#include "native.h"
+#include "occupancy.h"
+#include "tga.h"
+#include "threadpool.h"
+#include "trim.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <png.h>
+#include <stdexcept>
 
-Buffer::Buffer()
+Buffer::Buffer(PixelFormat pf) : format(pf), bits(nullptr), premultiplied(false)
 {
 }
 
-Buffer::Buffer(const Size& s, const Color& c) : size(s)
+Buffer::Buffer(const Size& s, const Color& c, PixelFormat pf) : format(pf), bits(nullptr), size(s), premultiplied(false)
 {
 	Reset(c);
 }
 
+Buffer::Buffer(const Buffer& b) : format(RGBA32F), bits(nullptr), premultiplied(false)
+{
+	*this = b;
+}
+
+Buffer::Buffer(Buffer&& b) : format(RGBA32F), bits(nullptr), premultiplied(false)
+{
+	*this = std::move(b);
+}
+
+Buffer& Buffer::operator = (const Buffer& b)
+{
+	if (this != &b)
+	{
+		// Always copy the pixels, even from a mapped buffer.
+		format = b.format;
+		size = b.size;
+		premultiplied = b.premultiplied;
+
+		size_t n = size.W * size.H * Format::BytesPerPixel(format);
+		Allocate(n);
+
+		if (n)
+			memcpy(bits, b.bits, n);
+
+		occupancy.reset((b.occupancy) ? new OccupancyIndex(*b.occupancy) : nullptr);
+	}
+
+	return *this;
+}
+
+Buffer& Buffer::operator = (Buffer&& b)
+{
+	if (this != &b)
+	{
+		format = b.format;
+		size = b.size;
+		premultiplied = b.premultiplied;
+		bytes = std::move(b.bytes);
+		mapping = std::move(b.mapping);
+		occupancy = std::move(b.occupancy);
+		bits = b.bits;
+
+		b.bytes.clear();
+		b.bits = nullptr;
+		b.size = Size();
+	}
+
+	return *this;
+}
+
+void Buffer::Allocate(size_t n)
+{
+	mapping.reset();
+	bytes.clear();
+	bytes.resize(n);
+	bits = bytes.data();
+
+	InvalidateFrom(0);
+}
+
+void Buffer::InvalidateFrom(int top)
+{
+	if (occupancy)
+		occupancy->Invalidate(top);
+}
+
+void Buffer::IndexOccupancy(const Mask& m)
+{
+	occupancy.reset(new OccupancyIndex(m));
+}
+
+void Buffer::DropOccupancyIndex()
+{
+	occupancy.reset();
+}
+
+void Buffer::Touched(const Rect& r)
+{
+	InvalidateFrom(std::min(r.top, r.bottom));
+}
+
+unsigned int Buffer::CountOccupied(const Rect& r, const Mask& m) const
+{
+	Rect lr = r;
+	LimitRect(lr);
+
+	if (lr.left > lr.right || lr.top > lr.bottom)
+		return 0;
+
+	if (occupancy && occupancy->GetMask() == m)
+		return occupancy->Count(bits, size, format, lr);
+
+	return Format::Dispatch(format, [&](auto f) {
+		typedef decltype(f) F;
+		const Format::MaskTest<F> test(m);
+		const auto *px = (const typename F::Type *)bits;
+		unsigned int n = 0;
+
+		for (int y = lr.top; y <= lr.bottom; y++)
+		{
+			for (int x = lr.left; x <= lr.right; x++)
+				n += test(px[y * size.W + x]) ? 1 : 0;
+		}
+
+		return n;
+	});
+}
+
 void Buffer::Reset(const Size& s, const Color& c)
 {
 	size = s;
@@ -47,122 +172,603 @@ void Buffer::Reset(const Size& s, const Color& c)
 void Buffer::Reset(const Color& c)
 {
 	// Force a resize of the array with the chosen color.
-	colors.clear();
-	colors.resize(size.W * size.H, c);
+	Allocate(size.W * size.H * Format::BytesPerPixel(format));
+
+	// c is straight, and stored premultiplied in a premultiplied buffer.
+	Color fill = c;
+
+	if (premultiplied)
+		Composite::Premultiply(&fill, 1);
+
+	Format::Dispatch(format, [&](auto f) {
+		typedef decltype(f) F;
+		auto *px = (typename F::Type *)bits;
+		std::fill(px, px + size.W * size.H, Format::Store<F>(fill));
+	});
 }
 
-bool Buffer::Save(const std::string &filename, bool with_alpha)
+void Buffer::SetFormat(PixelFormat pf)
+{
+	if (pf == format)
+		return;
+
+	std::vector<unsigned char> converted(size.W * size.H * Format::BytesPerPixel(pf));
+	Format::ConvertRow(format, bits, pf, converted.data(), size.W * size.H);
+
+	mapping.reset();
+	bytes.swap(converted);
+	bits = bytes.data();
+	format = pf;
+
+	InvalidateFrom(0);
+}
+
+bool Buffer::Save(const std::string &filename, bool with_alpha, bool compress) const
+{
+	std::string sub = filename.substr(filename.size() - 4);
+
+	if (sub == ".2dl")
+		return SaveAs2DL(BufferView(*this), filename, compress, (premultiplied) ? Native::PREMULTIPLIED : 0);
+
+	if (premultiplied)
+	{
+		Buffer straight(*this);
+		straight.Unpremultiply();
+
+		return Save(BufferView(straight), filename, with_alpha, compress);
+	}
+
+	return Save(BufferView(*this), filename, with_alpha, compress);
+}
+
+bool Buffer::Save(const BufferView &v, const std::string &filename, bool with_alpha, bool compress)
 {
 	std::string sub = filename.substr(filename.size() - 4);
 
 	if (sub == ".png")
-		return SaveAsPNG(filename, with_alpha);
+		return SaveAsPNG(v, filename, with_alpha, PNGWriter::Options((compress) ? 9 : 6));
 	if (sub == ".tga")
-		return SaveAsTGA(filename, with_alpha);
+		return SaveAsTGA(v, filename, with_alpha, compress);
+	if (sub == ".2dl")
+		return SaveAs2DL(v, filename, compress);
 
 	return false;
 }
 
+bool Buffer::SavePNG(const std::string &filename, const PNGWriter::Options &opt, bool with_alpha) const
+{
+	if (premultiplied)
+	{
+		Buffer straight(*this);
+		straight.Unpremultiply();
+
+		return SaveAsPNG(BufferView(straight), filename, with_alpha, opt);
+	}
+
+	return SaveAsPNG(BufferView(*this), filename, with_alpha, opt);
+}
+
+bool Buffer::SavePNG(const BufferView &v, const std::string &filename, const PNGWriter::Options &opt, bool with_alpha)
+{
+	return SaveAsPNG(v, filename, with_alpha, opt);
+}
+
+std::future<Buffer> Buffer::LoadAsync(const std::string &filename, PixelFormat pf)
+{
+	return ThreadPool::Shared().Submit([filename, pf]() {
+		Buffer b(pf);
+
+		if (!b.Load(filename))
+			throw std::runtime_error("Unsupported or unreadable file " + filename);
+
+		return b;
+	});
+}
+
+std::future<bool> Buffer::SaveAsync(const std::string &filename, bool with_alpha, bool compress) const
+{
+	return ThreadPool::Shared().Submit([this, filename, with_alpha, compress]() { return Save(filename, with_alpha, compress); });
+}
+
 bool Buffer::Load(const std::string &filename, bool with_alpha)
 {
 	std::string sub = filename.substr(filename.size() - 4);
+	premultiplied = false;
 
 	if (sub == ".png")
 		return LoadFromPNG(filename);
 	if (sub == ".tga")
 		return LoadFromTGA(filename);
+	if (sub == ".2dl")
+		return LoadFrom2DL(filename, nullptr);
 
 	return false;
 }
 
-static unsigned char bgr[3];
-static unsigned char bgra[4];
+bool Buffer::LoadRect(const std::string &filename, const Rect& r)
+{
+	std::string sub = filename.substr(filename.size() - 4);
 
-bool Buffer::LoadFromTGA(const std::string &filename)
+	if (sub == ".2dl")
+		return LoadFrom2DL(filename, &r);
+
+	premultiplied = false;
+	Buffer whole(format);
+
+	if (!whole.Load(filename))
+		return false;
+
+	Rect lr = r;
+	whole.LimitRect(lr);
+
+	if (lr.left > lr.right || lr.top > lr.bottom)
+		return false;
+
+	Reset(Size(lr.GetWidth(), lr.GetHeight()), RGBA::NoAlpha);
+	CopyRectFromBuffer(lr.GetNormal(), lr, whole);
+
+	return true;
+}
+
+bool Buffer::Map(const std::string &filename)
 {
-	FILE *fp = fopen(filename.c_str(), "rb");
+	std::string sub = filename.substr(filename.size() - 4);
 
-	if (fp)
+	if (sub == ".2dl")
 	{
-		// make sure the array is empty.
-		colors.clear();
+		FILE *fp = fopen(filename.c_str(), "rb");
 
-		unsigned char header[18];
+		if (!fp)
+			return false;
 
-		// 18 byte header.  This only reads version 2 (top-down, left-right), non-compressed, 32 bit image.
-		fread(header, 18, 1, fp);
+		Native::Header header;
+		bool raw = Native::ReadHeader(fp, header) && header.compression == Native::NONE;
 
-		// Get dimensions
-		size.W = (((int)header[13]) << 8) + (int)header[12];
-		size.H = (((int)header[15]) << 8) + (int)header[14];
+		fclose(fp);
 
-		size_t comps_size = header[16] >> 3;
+		std::unique_ptr<MappedFile> file(new MappedFile);
 
-		unsigned char *comps = (comps_size == 4) ? bgra : bgr;
+		// The file may have changed since the header was read.
+		if (raw && file->Open(filename) && header.data_offset <= file->GetSize() &&
+			header.ImageBytes() <= file->GetSize() - header.data_offset)
+		{
+			// Use the pixels in place.
+			bytes.clear();
+			bytes.shrink_to_fit();
+
+			format = header.format;
+			size = Size(header.width, header.height);
+			premultiplied = (header.flags & Native::PREMULTIPLIED) != 0;
+			bits = file->GetData() + header.data_offset;
+			mapping = std::move(file);
+			InvalidateFrom(0);
+
+			return true;
+		}
+	}
+	else if (sub == ".tga")
+	{
+		FILE *fp = fopen(filename.c_str(), "rb");
+
+		if (!fp)
+			return false;
+
+		TGA::Header header;
+		bool raw = TGA::ReadHeader(fp, header) && !header.IsRLE() && header.IsTopDown() && !header.IsRightToLeft();
+		long offset = ftell(fp);
 
-		int max = size.W * size.H;
+		fclose(fp);
 
-		Color c;
+		std::unique_ptr<MappedFile> file(new MappedFile);
 
-		// Read all data as BGR components.
-		for (int i = 0; i<max; i++)
+		if (raw && file->Open(filename) && offset + header.RowSize() * header.height <= file->GetSize())
 		{
-			fread(comps, comps_size, 1, fp);
+			// Use the pixels in place.
+			bytes.clear();
+			bytes.shrink_to_fit();
+
+			format = (header.PixelSize() == 4) ? BGRA8 : BGR8;
+			size = Size(header.width, header.height);
+			premultiplied = false;
+			bits = file->GetData() + offset;
+			mapping = std::move(file);
+			InvalidateFrom(0);
+
+			return true;
+		}
+	}
 
-			if (feof(fp))
-				return false;
+	return Load(filename);
+}
 
-			RGBA::FromBGRA(c, comps, comps_size);
-			colors.push_back(c);
+// Codecs move pixels in blocks of about this many bytes.
+static const size_t IO_BLOCK = 1 << 20;
+
+static int RowsPerBlock(size_t row_size)
+{
+	return (int)std::max((size_t)1, IO_BLOCK / std::max((size_t)1, row_size));
+}
+
+void Buffer::FlipRows()
+{
+	size_t row_size = size.W * Format::BytesPerPixel(format);
+	std::vector<unsigned char> tmp(row_size);
+
+	for (int top = 0, bottom = size.H - 1; top < bottom; top++, bottom--)
+	{
+		memcpy(tmp.data(), bits + top * row_size, row_size);
+		memcpy(bits + top * row_size, bits + bottom * row_size, row_size);
+		memcpy(bits + bottom * row_size, tmp.data(), row_size);
+	}
+}
+
+void Buffer::MirrorRows()
+{
+	Format::Dispatch(format, [&](auto f) {
+		typedef decltype(f) F;
+		auto *px = (typename F::Type *)bits;
+
+		for (int j = 0; j < size.H; j++)
+			std::reverse(px + j * size.W, px + (j + 1) * size.W);
+	});
+}
+
+bool Buffer::LoadFromTGA(const std::string &filename)
+{
+	FILE *fp = fopen(filename.c_str(), "rb");
+
+	if (fp)
+	{
+		// 18 byte header.  This reads raw (type 2) and RLE (type 10), 24 or 32 bit images in any orientation.
+		TGA::Header header;
+
+		if (!TGA::ReadHeader(fp, header))
+		{
+			fclose(fp);
+			return false;
+		}
+
+		// Get dimensions
+		size.W = header.width;
+		size.H = header.height;
+
+		PixelFormat file_format = (header.PixelSize() == 4) ? BGRA8 : BGR8;
+
+		// Size the array once; the file is read straight into it when the formats
+		// match, otherwise through a staging block converted row by row.
+		size_t bpp = Format::BytesPerPixel(format);
+		Allocate(size.W * size.H * bpp);
+
+		TGA::Reader reader(fp, header);
+		bool ok = true;
+
+		if (file_format == format)
+			ok = reader.ReadRows(bits, size.H);
+		else
+		{
+			size_t row_size = header.RowSize();
+			int block = RowsPerBlock(row_size);
+			std::vector<unsigned char> staging(block * row_size);
+
+			for (int j = 0; ok && j < size.H; j += block)
+			{
+				int rows = std::min(block, size.H - j);
+				ok = reader.ReadRows(staging.data(), rows);
+
+				for (int k = 0; ok && k < rows; k++)
+					Format::ConvertRow(file_format, &staging[k * row_size], format, bits + (j + k) * size.W * bpp, size.W);
+			}
 		}
 
 		fclose(fp);
 
+		if (!ok)
+			return false;
+
+		// Rows were stored in file order; make them top-down, left-right.
+		if (!header.IsTopDown())
+			FlipRows();
+
+		if (header.IsRightToLeft())
+			MirrorRows();
+
 		return true;
 	}
 
 	return false;
 }
 
-bool Buffer::SaveAsTGA(const std::string &filename, bool with_alpha)
+bool Buffer::SaveAsTGA(const BufferView &v, const std::string &filename, bool with_alpha, bool rle)
 {
 	FILE *fp = fopen(filename.c_str(), "wb");
 
 	if (fp)
 	{
 		// TGAs are stored as blue-green-red components (alpha optional).
-		unsigned char *comps = (with_alpha) ? bgra : bgr;
 		size_t comps_size = (with_alpha) ? 4 : 3;
+		PixelFormat file_format = (with_alpha) ? BGRA8 : BGR8;
 
-		// 18 byte header.  This is a version 2 (top-down, left-right), non-compressed, 24 or 32 bit image.
-		unsigned char header[18] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
-		(unsigned char)(size.W & 0x00FF), (unsigned char)(size.W >> 8),
-		(unsigned char)(size.H & 0x00FF), (unsigned char)(size.H >> 8),
-		(unsigned char)(comps_size << 3), (unsigned char)0x20
-	   };
+		// 18 byte header.  This is a top-down, left-right, raw (type 2) or RLE (type 10), 24 or 32 bit image.
+		Size size = v.GetSize();
+		PixelFormat format = v.GetFormat();
 
-		// Write header
-		fwrite(header, 18, 1, fp);
+		TGA::Header header(size.W, size.H, (int)(comps_size << 3), rle);
+		bool ok = TGA::WriteHeader(fp, header);
 
-		// Write all data as BGR components.
-		for (size_t i=0; i<colors.size(); i++)
+		if (!rle && file_format == format && v.IsContiguous())
+		{
+			// Already in file layout: write it all in one go.
+			size_t n = header.RowSize() * size.H;
+			ok = ok && (n == 0 || fwrite(v.Row(0), n, 1, fp) == 1);
+		}
+		else
 		{
-			RGBA::ToBGRA(comps, comps_size, colors[i]);
-			fwrite(comps, comps_size, 1, fp);
+			// Convert and encode rows into a block, written when full.
+			size_t row_size = header.RowSize();
+			std::vector<unsigned char> row(row_size);
+			std::vector<unsigned char> out;
+			out.reserve(IO_BLOCK + row_size * 2);
+
+			for (int j = 0; ok && j < size.H; j++)
+			{
+				const unsigned char *src = v.Row(j);
+
+				if (file_format != format)
+				{
+					Format::ConvertRow(format, src, file_format, row.data(), size.W);
+					src = row.data();
+				}
+
+				if (rle)
+					TGA::EncodeRow(src, comps_size, size.W, out);
+				else
+					out.insert(out.end(), src, src + row_size);
+
+				if (out.size() >= IO_BLOCK || j == size.H - 1)
+				{
+					ok = (fwrite(out.data(), out.size(), 1, fp) == 1);
+					out.clear();
+				}
+			}
 		}
 
 		//// NOTE:  No footer is written.  All readers I encountered ignored the extra "developper" data.
 
 		fclose(fp);
 
-		return true;
+		return ok;
 	}
 
 	return false;
 }
 
-static unsigned char rgb[3];
-static unsigned char rgba[4];
+bool Buffer::LoadFrom2DL(const std::string &filename, const Rect *area)
+{
+	FILE *fp = fopen(filename.c_str(), "rb");
+
+	if (!fp)
+		return false;
+
+	Native::Header header;
+
+	if (!Native::ReadHeader(fp, header))
+	{
+		fclose(fp);
+		return false;
+	}
+
+	// The part of the image we want.
+	Rect r(Point::Origin, Size(header.width, header.height));
+
+	if (area)
+	{
+		r = *area;
+		r.left = std::max(r.left, 0);
+		r.top = std::max(r.top, 0);
+		r.right = std::min(r.right, header.width - 1);
+		r.bottom = std::min(r.bottom, header.height - 1);
+	}
+
+	if (r.left > r.right || r.top > r.bottom)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	size = Size(r.GetWidth(), r.GetHeight());
+
+	size_t bpp = Format::BytesPerPixel(format);
+	size_t file_bpp = Format::BytesPerPixel(header.format);
+	Allocate((size_t)size.W * size.H * bpp);
+
+	// The alpha mode is only taken once the pixels are in.
+	bool file_premultiplied = (header.flags & Native::PREMULTIPLIED) != 0;
+	bool ok = true;
+
+	if (header.compression == Native::NONE)
+	{
+		if (size.W == header.width && header.format == format)
+		{
+			// Whole rows in our format: read them in one go.
+			ok = Native::Seek(fp, header.data_offset + (unsigned long long)r.top * header.width * file_bpp) &&
+				fread(bits, (size_t)size.W * size.H * bpp, 1, fp) == 1;
+		}
+		else
+		{
+			std::vector<unsigned char> row(size.W * file_bpp);
+
+			for (int y = r.top; ok && y <= r.bottom; y++)
+			{
+				ok = Native::Seek(fp, header.data_offset + ((unsigned long long)y * header.width + r.left) * file_bpp) &&
+					fread(row.data(), row.size(), 1, fp) == 1;
+
+				if (ok)
+					Format::ConvertRow(header.format, row.data(), format, bits + (size_t)(y - r.top) * size.W * bpp, size.W);
+			}
+		}
+
+		fclose(fp);
+
+		if (ok)
+			premultiplied = file_premultiplied;
+
+		return ok;
+	}
+
+	std::vector<Native::Tile> index;
+
+	if (!Native::ReadIndex(fp, header, index))
+	{
+		fclose(fp);
+		return false;
+	}
+
+	// Read the compressed tiles that r touches, in file order.
+	int tx0 = r.left / header.tile_w, tx1 = r.right / header.tile_w;
+	int ty0 = r.top / header.tile_h, ty1 = r.bottom / header.tile_h;
+
+	std::vector<int> tiles;
+	std::vector<std::vector<unsigned char>> packed;
+
+	for (int ty = ty0; ok && ty <= ty1; ty++)
+	{
+		for (int tx = tx0; ok && tx <= tx1; tx++)
+		{
+			const Native::Tile &t = index[ty * header.TilesX() + tx];
+
+			tiles.push_back(ty * header.TilesX() + tx);
+			packed.push_back(std::vector<unsigned char>((size_t)t.length));
+
+			ok = Native::Seek(fp, t.offset) && (t.length == 0 || fread(packed.back().data(), (size_t)t.length, 1, fp) == 1);
+		}
+	}
+
+	fclose(fp);
+
+	if (!ok)
+		return false;
+
+	// Then inflate them in parallel, each into its part of the buffer.
+	std::atomic<bool> failed(false);
+
+	ThreadPool::Shared().For((int)tiles.size(), [&](int i) {
+		int tx = tiles[i] % header.TilesX(), ty = tiles[i] / header.TilesX();
+		Rect tr(Point(tx * header.tile_w, ty * header.tile_h), Size(header.tile_w, header.tile_h));
+		tr.right = std::min(tr.right, header.width - 1);
+		tr.bottom = std::min(tr.bottom, header.height - 1);
+
+		size_t tile_row = tr.GetWidth() * file_bpp;
+		std::vector<unsigned char> tile(tile_row * tr.GetHeight());
+
+		// More than deflate could have packed in there.
+		if (tile.size() / Native::MAX_DEFLATE_RATIO > packed[i].size())
+		{
+			failed = true;
+			return;
+		}
+
+		if (!Native::DecompressTile(packed[i].data(), packed[i].size(), tile.data(), tile.size()))
+		{
+			failed = true;
+			return;
+		}
+
+		int x0 = std::max(tr.left, r.left), x1 = std::min(tr.right, r.right);
+		int y0 = std::max(tr.top, r.top), y1 = std::min(tr.bottom, r.bottom);
+
+		for (int y = y0; y <= y1; y++)
+			Format::ConvertRow(header.format, &tile[(y - tr.top) * tile_row + (x0 - tr.left) * file_bpp],
+				format, bits + ((size_t)(y - r.top) * size.W + (x0 - r.left)) * bpp, x1 - x0 + 1);
+	});
+
+	if (failed)
+		return false;
+
+	premultiplied = file_premultiplied;
+	return true;
+}
+
+bool Buffer::SaveAs2DL(const BufferView &v, const std::string &filename, bool tiled, unsigned short flags)
+{
+	FILE *fp = fopen(filename.c_str(), "wb");
+
+	if (!fp)
+		return false;
+
+	Size size = v.GetSize();
+	PixelFormat format = v.GetFormat();
+	size_t bpp = Format::BytesPerPixel(format);
+
+	Native::Header header;
+	header.format = format;
+	header.width = size.W;
+	header.height = size.H;
+	header.flags = flags;
+
+	bool ok = true;
+
+	if (!tiled)
+	{
+		// The pixels as they are in memory, right after the header.
+		size_t row = size.W * bpp;
+		ok = Native::WriteHeader(fp, header);
+
+		if (v.IsContiguous())
+			ok = ok && (row * size.H == 0 || fwrite(v.Row(0), row * size.H, 1, fp) == 1);
+		else
+		{
+			for (int y = 0; ok && y < size.H; y++)
+				ok = (row == 0 || fwrite(v.Row(y), row, 1, fp) == 1);
+		}
+
+		fclose(fp);
+		return ok;
+	}
+
+	header.compression = Native::DEFLATE;
+	header.tile_w = header.tile_h = Native::TILE_SIZE;
+
+	// Deflate all tiles in parallel, then write them in order followed by the index.
+	int tiles_x = header.TilesX(), tiles_y = header.TilesY();
+	std::vector<std::vector<unsigned char>> packed(tiles_x * tiles_y);
+	std::atomic<bool> failed(false);
+
+	ThreadPool::Shared().For(tiles_x * tiles_y, [&](int i) {
+		Rect tr(Point((i % tiles_x) * header.tile_w, (i / tiles_x) * header.tile_h), Size(header.tile_w, header.tile_h));
+		tr.right = std::min(tr.right, size.W - 1);
+		tr.bottom = std::min(tr.bottom, size.H - 1);
+
+		size_t tile_row = tr.GetWidth() * bpp;
+		std::vector<unsigned char> tile(tile_row * tr.GetHeight());
+
+		for (int y = tr.top; y <= tr.bottom; y++)
+			memcpy(&tile[(y - tr.top) * tile_row], v.Row(y) + tr.left * bpp, tile_row);
+
+		if (!Native::CompressTile(tile.data(), tile.size(), packed[i]))
+			failed = true;
+	});
+
+	std::vector<Native::Tile> index(packed.size());
+	unsigned long long offset = header.data_offset;
+
+	for (size_t i = 0; i < packed.size(); i++)
+	{
+		index[i].offset = offset;
+		index[i].length = packed[i].size();
+		offset += packed[i].size();
+	}
+
+	header.index_offset = offset;
+	ok = !failed && Native::WriteHeader(fp, header);
+
+	for (size_t i = 0; ok && i < packed.size(); i++)
+		ok = (packed[i].empty() || fwrite(packed[i].data(), packed[i].size(), 1, fp) == 1);
+
+	ok = ok && Native::WriteIndex(fp, index);
+
+	fclose(fp);
+	return ok;
+}
 
 bool Buffer::LoadFromPNG(const std::string &filename)
 {
@@ -173,216 +779,278 @@ bool Buffer::LoadFromPNG(const std::string &filename)
 		throw(PNG_Exception(filename, "[read_png_file] File %s could not be opened for reading."));
 
 	char header[8];    // 8 is the maximum size that can be checked
-	fread(header, 1, 8, fp);
 
-	if (png_sig_cmp((png_const_bytep)header, 0, 8))
+	if (fread(header, 1, 8, fp) != 8 || png_sig_cmp((png_const_bytep)header, 0, 8))
+	{
+		fclose(fp);
 		throw(PNG_Exception(filename, "[read_png_file] File %s is not recognized as a PNG file."));
+	}
 
 	/* initialize stuff */
 	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 
 	if (!png_ptr)
+	{
+		fclose(fp);
 		throw(PNG_Exception(filename, "[read_png_file] png_create_read_struct failed"));
+	}
 
 	png_infop info_ptr = png_create_info_struct(png_ptr);
 
 	if (!info_ptr)
+	{
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		fclose(fp);
 		throw(PNG_Exception(filename, "[read_png_file] png_create_info_struct failed"));
+	}
+
+	// Everything libpng writes into lives here, declared before setjmp() so
+	// that nothing is skipped when it jumps back.
+	std::vector<png_bytep> row_pointers;
+	std::vector<unsigned char> staging;
 
 	if (setjmp(png_jmpbuf(png_ptr)))
-		throw(PNG_Exception(filename, "[read_png_file] Error during init_io"));
+	{
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		fclose(fp);
+		throw(PNG_Exception(filename, "[read_png_file] Error while reading %s"));
+	}
 
 	png_init_io(png_ptr, fp);
 	png_set_sig_bytes(png_ptr, 8);
 
 	png_read_info(png_ptr, info_ptr);
 
-	size.W = png_get_image_width(png_ptr, info_ptr);
-	size.H = png_get_image_height(png_ptr, info_ptr);
+	int width = png_get_image_width(png_ptr, info_ptr);
+	int height = png_get_image_height(png_ptr, info_ptr);
 	png_byte colorType = png_get_color_type(png_ptr, info_ptr);
 	png_byte bitDepth = png_get_bit_depth(png_ptr, info_ptr);
 
-	int numPasses = png_set_interlace_handling(png_ptr);
-	png_read_update_info(png_ptr, info_ptr);
-
-	/* read file */
-	if (setjmp(png_jmpbuf(png_ptr)))
-		throw(PNG_Exception(filename, "[read_png_file] Error during read_image"));
+	// Let libpng bring every kind of PNG to 8 bit RGB or RGBA.
+	if (colorType == PNG_COLOR_TYPE_PALETTE)
+		png_set_palette_to_rgb(png_ptr);
 
-	png_bytep* row_pointers = (png_bytep*)malloc(sizeof(png_bytep) * size.H);
-	for (int y = 0; y < size.H; y++)
-		row_pointers[y] = (png_byte*)malloc(png_get_rowbytes(png_ptr, info_ptr));
+	if (colorType == PNG_COLOR_TYPE_GRAY && bitDepth < 8)
+		png_set_expand_gray_1_2_4_to_8(png_ptr);
 
-	png_read_image(png_ptr, row_pointers);
-
-	fclose(fp);
+	if (colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_GRAY_ALPHA)
+		png_set_gray_to_rgb(png_ptr);
 
-	unsigned char* r = rgba;
-	size_t s = 4;
+	bool has_alpha = (colorType & PNG_COLOR_MASK_ALPHA) != 0;
 
-	if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_RGB)
+	if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
 	{
-		r = rgb;
-		s = 3;
+		png_set_tRNS_to_alpha(png_ptr);
+		has_alpha = true;
 	}
-	else if (png_get_color_type(png_ptr, info_ptr) != PNG_COLOR_TYPE_RGBA)
-		return false;
 
-	// Now copy values in the buffer.
-	unsigned char rgba[4];
-	Color c;
+	if (bitDepth == 16)
+		png_set_scale_16(png_ptr);
 
-	colors.clear();
+	// Then to our own layout when it is one of those, so rows decode in place.
+	// Other formats decode as RGBA and go through the row converter.
+	PixelFormat file_format = (format == RGB8 || format == BGR8 || format == BGRA8) ? format : RGBA8;
+	bool four = (file_format == RGBA8 || file_format == BGRA8);
 
-	for (int j = 0; j < size.H; j++)
-	{
-		png_byte *r = row_pointers[j];
+	if (four && !has_alpha)
+		png_set_filler(png_ptr, 0xFF, PNG_FILLER_AFTER);
+	else if (!four && has_alpha)
+		png_set_strip_alpha(png_ptr);
 
-		for (size_t i = 0; i < size.W * s; i+=s)
-		{
-			rgba[0] = r[i];
-			rgba[1] = r[i+1];
-			rgba[2] = r[i+2];
+	if (file_format == BGRA8 || file_format == BGR8)
+		png_set_bgr(png_ptr);
 
-			if (s == 4)
-				rgba[3] = r[i+3];
+	int numPasses = png_set_interlace_handling(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
 
-			RGBA::FromRGBA(c, rgba, 4);
-			colors.push_back(c);
-		}
-	}
+	size_t row_size = width * Format::BytesPerPixel(file_format);
 
-	delete[] row_pointers;
+	if (png_get_rowbytes(png_ptr, info_ptr) != row_size)
+		png_error(png_ptr, "unexpected row size");
 
-	return true;
-}
+	/* read file */
+	size = Size(width, height);
 
-bool Buffer::SaveAsPNG(const std::string &filename, bool with_alpha)
-{
-	std::vector<std::vector<unsigned char>> all_rows;
-	std::vector<unsigned char *> p_rows;
+	size_t bpp = Format::BytesPerPixel(format);
+	Allocate(size.W * size.H * bpp);
 
-	unsigned char comps[4];
-	int k = 0;
-	int s = (with_alpha) ?4 : 3;
+	if (file_format == format)
+	{
+		// Straight into the buffer.
+		row_pointers.resize(size.H);
 
-	for (int j=0; j<size.H; j++)
+		for (int y = 0; y < size.H; y++)
+			row_pointers[y] = bits + y * row_size;
+
+		png_read_image(png_ptr, row_pointers.data());
+	}
+	else if (numPasses > 1)
 	{
-		// Push an empty vector
-		all_rows.push_back(std::vector<unsigned char>());
+		// Interlaced passes revisit every row, so they need the whole image.
+		staging.resize(row_size * size.H);
+		row_pointers.resize(size.H);
 
-		// Get a reference to it
-		std::vector<unsigned char> &r = all_rows[all_rows.size() - 1];
+		for (int y = 0; y < size.H; y++)
+			row_pointers[y] = &staging[y * row_size];
 
-		// Insert stuff into it
-		for (int i=0; i<size.W; i++, k++)
-		{
-			RGBA::ToRGBA(comps, s, colors[k]);
+		png_read_image(png_ptr, row_pointers.data());
 
-			r.push_back(comps[0]);
-			r.push_back(comps[1]);
-			r.push_back(comps[2]);
+		for (int y = 0; y < size.H; y++)
+			Format::ConvertRow(file_format, row_pointers[y], format, bits + y * size.W * bpp, size.W);
+	}
+	else
+	{
+		// One row at a time, reusing the same row.
+		staging.resize(row_size);
 
-			if (s == 4)
-				r.push_back(comps[3]);
+		for (int y = 0; y < size.H; y++)
+		{
+			png_read_row(png_ptr, staging.data(), NULL);
+			Format::ConvertRow(file_format, staging.data(), format, bits + y * size.W * bpp, size.W);
 		}
-
-		// Keep the pointer to its data.
-		p_rows.push_back(r.data());
 	}
 
-	////// Done.  All nice and cleans itself up at the end of the method.
+	png_read_end(png_ptr, NULL);
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+	fclose(fp);
+
+	return true;
+}
+
+bool Buffer::SaveAsPNG(const BufferView &v, const std::string &filename, bool with_alpha, const PNGWriter::Options &opt)
+{
+	PixelFormat format = v.GetFormat(), file_format = (with_alpha) ? RGBA8 : RGB8;
+	Size size = v.GetSize();
+
+	// Rows already stored as the file wants them are handed over as they are.
+	auto rows = [&](int y, unsigned char *scratch) -> const unsigned char * {
+		const unsigned char *src = v.Row(y);
 
-	png_bytep* row_pointers = (png_bytep *)p_rows.data();
-	png_byte colorType = 6;
-	png_byte bitDepth = 8;
+		if (format == file_format)
+			return src;
 
-	png_structp png_ptr;
-	//int number_of_passes;
-	png_infop info_ptr;
-	//	png_byte header[8];    // 8 is the maximum size that can be checked
+		Format::ConvertRow(format, src, file_format, scratch, size.W);
+		return scratch;
+	};
 
-	/* create file */
 	FILE *fp = fopen(filename.c_str(), "wb");
 
 	if (!fp)
 		throw(PNG_Exception(filename, "[write_png_file] File %s could not be opened for writing"));
 
-	/* initialize stuff */
-	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-
-	if (!png_ptr)
-		throw(PNG_Exception(filename, "[write_png_file] png_create_write_struct failed"));
+	bool ok = PNGWriter::Write(fp, size.W, size.H, (with_alpha) ? 4 : 3, rows, opt);
 
-	info_ptr = png_create_info_struct(png_ptr);
+	if (fclose(fp) != 0)
+		ok = false;
 
-	if (!info_ptr)
-		throw(PNG_Exception(filename, "[write_png_file] png_create_info_struct failed"));
+	if (!ok)
+		throw(PNG_Exception(filename, "[write_png_file] Error during writing bytes"));
 
-	if (setjmp(png_jmpbuf(png_ptr)))
-		throw(PNG_Exception(filename, "[write_png_file] Error during init_io"));
+	return true;
+}
 
-	png_init_io(png_ptr, fp);
+static const Color nullColor;
 
-	/* write header */
-	if (setjmp(png_jmpbuf(png_ptr)))
-		throw(PNG_Exception(filename, "[write_png_file] Error during writing header"));
+// Helpers on work values (Pixel or Color) so kernels are written once for all formats.
 
-	png_set_IHDR(png_ptr, info_ptr, size.W, size.H,
-		bitDepth, colorType, PNG_INTERLACE_NONE,
-		PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+static inline bool IsAlphaBelow(const Pixel& w, float t)
+{
+	// w.a / 255 < t  <=>  w.a < ceil(t * 255) for integer alphas.
+	return w.a < std::ceil(t * 255.f);
+}
 
-	png_write_info(png_ptr, info_ptr);
+static inline bool IsAlphaBelow(const Color& w, float t)
+{
+	return w.a < t;
+}
 
-	/* write bytes */
-	if (setjmp(png_jmpbuf(png_ptr)))
-		throw(PNG_Exception(filename, "[write_png_file] Error during writing bytes"));
+static inline Pixel ToGray(const Pixel& w)
+{
+	// Same weights as below in 8 bit fixed point (57 + 181 + 18 = 256).
+	unsigned char v = (unsigned char)((w.r * 57 + w.g * 181 + w.b * 18 + 128) >> 8);
+	Pixel g = { v, v, v, w.a };
+	return g;
+}
 
-	png_write_image(png_ptr, row_pointers);
+static inline Color ToGray(const Color& c)
+{
+	auto dot = [](Color a, Color b) { return (a.r * b.r + a.g * b.g + a.b * b.b); };
 
-	/* end write */
-	if (setjmp(png_jmpbuf(png_ptr)))
-		throw(PNG_Exception(filename, "[write_png_file] Error during end of write"));
+	Color base(0.222f, 0.707, 0.071, 1.f);
 
-	png_write_end(png_ptr, NULL);
+	Color g(dot(c, base));
+	g.a = c.a;
+	return g;
+}
 
-	fclose(fp);
+void Buffer::Sanitize()
+{
+	PixelOps::Transform(BufferView(*this), [](auto w) {
+		return (Format::IsTransparent(w)) ? Format::FromColor<decltype(w)>(RGBA::NoAlpha) : w;
+	});
 
-	return true;
+	InvalidateFrom(0);
 }
 
-void Buffer::Sanitize()
+void Buffer::Set(const Point &p, const Color& c)
 {
-	for (auto& c : colors)
+	// Check under/over flow.
+	if (p.X >= 0 && p.X < size.W && p.Y >= 0 && p.Y < size.H)
 	{
-		if (c.a == 0.f)
-			c = RGBA::NoAlpha;
+		Format::Dispatch(format, [&](auto f) {
+			typedef decltype(f) F;
+			((typename F::Type *)bits)[p.Y * size.W + p.X] = Format::Store<F>(c);
+		});
+
+		InvalidateFrom(p.Y);
 	}
 }
 
-void Buffer::Set(const Point &p, const Color& c)
+Color Buffer::Get(const Point &p) const
 {
 	// Check under/over flow.
 	if (p.X >= 0 && p.X < size.W && p.Y >= 0 && p.Y < size.H)
-		colors[p.Y * size.W + p.X] = c;
+	{
+		return Format::Dispatch(format, [&](auto f) {
+			typedef decltype(f) F;
+			return Format::Load<F>(((const typename F::Type *)bits)[p.Y * size.W + p.X]);
+		});
+	}
+
+	// When failing, return the color black.
+	return nullColor;
 }
 
-static const Color nullColor;
+void Buffer::SetPixel(const Point &p, const Pixel& px)
+{
+	// Check under/over flow.
+	if (p.X >= 0 && p.X < size.W && p.Y >= 0 && p.Y < size.H)
+	{
+		Format::Dispatch(format, [&](auto f) {
+			typedef decltype(f) F;
+			((typename F::Type *)bits)[p.Y * size.W + p.X] = F::FromWork(Format::FromPixel<typename F::Work>(px));
+		});
 
-const Color & Buffer::Get(const Point &p) const
+		InvalidateFrom(p.Y);
+	}
+}
+
+Pixel Buffer::GetPixel(const Point &p) const
 {
 	// Check under/over flow.
 	if (p.X >= 0 && p.X < size.W && p.Y >= 0 && p.Y < size.H)
 	{
-		int z = p.Y * size.W + p.X;
-		return colors[p.Y * size.W + p.X];
+		return Format::Dispatch(format, [&](auto f) {
+			typedef decltype(f) F;
+			return Format::ToPixel(F::ToWork(((const typename F::Type *)bits)[p.Y * size.W + p.X]));
+		});
 	}
 
-	// When failing, return the color black.
-	return nullColor;
+	return RGBA::Pack(nullColor);
 }
 
-void Buffer::LimitPoint(Point &p)
+void Buffer::LimitPoint(Point &p) const
 {
 	if (p.X < 0)
 		p.X = 0;
@@ -397,7 +1065,7 @@ void Buffer::LimitPoint(Point &p)
 		p.Y = size.H - 1;
 }
 
-void Buffer::LimitRect(Rect &r)
+void Buffer::LimitRect(Rect &r) const
 {
 	if (r.left < 0)
 		r.left = 0;
@@ -414,248 +1082,356 @@ void Buffer::LimitRect(Rect &r)
 
 void Buffer::DrawRect(const Rect& r, const Color& c)
 {
+	BufferView(*this).DrawRect(r, c);
+
 	Rect lr = r;
 	LimitRect(lr);
-
-	Point p1 = lr.GetTopLeft(), p2 = lr.GetTopRight(), p3 = lr.GetBottomLeft(), p4 = lr.GetBottomRight();
-
-	DrawHorizontalLine(p1, p2, c);
-	DrawHorizontalLine(p3, p4, c);
-
-	DrawVerticalLine(p1, p3, c);
-	DrawVerticalLine(p2, p4, c);
+	InvalidateFrom(lr.top);
 }
 
 void Buffer::FillRect(const Rect& r, const Color& c)
 {
+	BufferView(*this).FillRect(r, c);
+
 	Rect lr = r;
 	LimitRect(lr);
+	InvalidateFrom(lr.top);
+}
 
-	Point p1 = lr.GetTopLeft();
-	Point p2 = lr.GetTopRight();
-	Point end = lr.GetBottomLeft() + Point(0, 1);
-
-	while (p1 != end)
-	{
-		DrawHorizontalLine(p1, p2, c);
+void Buffer::DrawHorizontalLine(const Point& start, const Point& end, const Color& c)
+{
+	BufferView(*this).DrawHorizontalLine(start, end, c);
 
-		p1 += Point(0, 1);
-		p2 += Point(0, 1);
-	}
+	Point s = start;
+	LimitPoint(s);
+	InvalidateFrom(s.Y);
 }
 
-void Buffer::DrawHorizontalLine(const Point& start, const Point& end, const Color& c)
+void Buffer::DrawVerticalLine(const Point& start, const Point& end, const Color& c)
 {
-	Point s = start, e = end;
+	BufferView(*this).DrawVerticalLine(start, end, c);
 
-	// Make sure we don't bust.
+	Point s = start;
 	LimitPoint(s);
-	LimitPoint(e);
+	InvalidateFrom(s.Y);
+}
+
+bool Buffer::Scan(const Point &start, const Point &end, ScanDirection dir, ScanState state, const Color &c, Point& hit)
+{
+	return BufferView(*this).Scan(start, end, dir, state, c, hit);
+}
+
+Rect Buffer::Trim(const Rect& r, const Mask& m) const
+{
+	return BufferView(*this).Trim(r, m);
+}
+
+Rect Buffer::IsolateRect(const Rect& r, const Color& avoid)
+{
+	return Trim(r, Mask::Except(avoid));
+}
+
+unsigned long long Buffer::Hash(const Rect& r) const
+{
+	return BufferView(*this, r).Hash();
+}
+
+unsigned long long Buffer::Hash() const
+{
+	return BufferView(*this).Hash();
+}
+
+std::vector<Rect> Buffer::FindRegions(const Mask& m, const Regions::Options& opt) const
+{
+	return BufferView(*this).FindRegions(m, opt);
+}
+
+bool Buffer::IsRectEmpty(const Rect& r, const Color& empty)
+{
+	bool no_alpha = (empty == RGBA::NoAlpha);
+
+	// Empty pixels are the empty color, or any transparent one for NoAlpha
+	// when the format has alpha.
+	bool any_transparent = no_alpha && Format::Dispatch(format, [](auto f) { return decltype(f)::HasAlpha; });
+
+	if (occupancy && occupancy->GetMask() == ((any_transparent) ? Mask::AlphaAbove(0.f) : Mask::Except(empty)))
+		return CountOccupied(r, occupancy->GetMask()) == 0;
+
+	return BufferView(*this).IsRectEmpty(r, empty);
+}
+
+void Buffer::CopyLineFromBuffer(int dst, int src, int size,  const Buffer& from)
+{
+	size_t to_bpp = Format::BytesPerPixel(format);
+	size_t from_bpp = Format::BytesPerPixel(from.format);
 
-	// Same Y, start is smaller than end.
-	if (s.Y == e.Y && s.X <= e.X)
+	Blit::Row(bits + dst * to_bpp, format, from.bits + src * from_bpp, from.format, size + 1);
+
+	if (from.premultiplied != premultiplied)
 	{
-		int ptr1 = s.Y * size.W + s.X;
-		int ptr2 = e.Y * size.W + e.X;
+		BufferView line(bits + dst * to_bpp, Size(size + 1, 1), format);
 
-		// start and ends overlap.
-		while (ptr1 <= ptr2)
-			colors[ptr1++] = c;
+		if (premultiplied)
+			Composite::Premultiply(line);
+		else
+			Composite::Unpremultiply(line);
 	}
+
+	if (this->size.W)
+		InvalidateFrom(dst / this->size.W);
 }
 
-void Buffer::DrawVerticalLine(const Point& start, const Point& end, const Color& c)
+void Buffer::CopyRectFromBuffer(const Rect& dst, const Rect& src, const Buffer& from)
 {
-	Point s = start, e = end;
+	Rect d = dst, s = src;
 
-	// Make sure we don't bust.
-	LimitPoint(s);
-	LimitPoint(e);
+	if (!Blit::Clip(d, size, s, from.size))
+		return;
 
-	// Same Y, start is smaller than end.
-	if (s.X == e.X && s.Y <= e.Y)
+	BufferView to(*this, d);
+	Blit::Copy(to, BufferView(from, s));
+
+	if (from.premultiplied != premultiplied)
 	{
-		int ptr1 = s.Y * size.W + s.X;
-		int ptr2 = e.Y * size.W + e.X;
+		if (premultiplied)
+			Composite::Premultiply(to);
+		else
+			Composite::Unpremultiply(to);
+	}
 
-		// start and ends overlap.
-		while (ptr1 <= ptr2)
-		{
-			colors[ptr1] = c;
-				ptr1 += size.W;
-		}
+	InvalidateFrom(d.top);
+}
+
+void Buffer::OrientRectFromBuffer(const Rect& dst, const Rect& src, const Buffer& from, Orientation::Op op)
+{
+	Rect d = dst, s = src;
+	LimitRect(d);
+	from.LimitRect(s);
+
+	if (d.left > d.right || d.top > d.bottom || s.left > s.right || s.top > s.bottom)
+		return;
+
+	Size r = Orientation::Result(Size(s.GetWidth(), s.GetHeight()), op);
+	d.right = std::min(d.right, d.left + r.W - 1);
+	d.bottom = std::min(d.bottom, d.top + r.H - 1);
+
+	BufferView to(*this, d);
+	Orientation::Apply(to, BufferView(from, s), op);
+
+	if (from.premultiplied != premultiplied)
+	{
+		if (premultiplied)
+			Composite::Premultiply(to);
+		else
+			Composite::Unpremultiply(to);
 	}
+
+	InvalidateFrom(d.top);
 }
 
-bool Buffer::Scan(const Point &start, const Point &end, ScanDirection dir, ScanState state, const Color &c, Point& hit)
+void Buffer::BlendRectFromBuffer(const Rect& dst, const Rect& src, const Buffer& from, const Composite::Options& opt)
 {
-	bool right = (start.X <= end.X);
-	bool down = (start.Y <= end.Y);
+	Rect d = dst, s = src;
 
-	hit = start;
-	Point stop = end;
+	if (!Blit::Clip(d, size, s, from.size))
+		return;
 
-	while (hit != stop)
+	Composite::Options o = opt;
+	o.premultiplied = premultiplied;
+
+	if (from.premultiplied != premultiplied)
 	{
-		Color hc = Get(hit);
+		// Bring the source to our alpha mode first.
+		Buffer tmp(Size(s.GetWidth(), s.GetHeight()), RGBA::NoAlpha, RGBA32F);
+		Blit::Copy(BufferView(tmp), BufferView(from, s));
 
-		// Check hit.  Consider transparent pixels to be one of the same regardless of color.
-		if (hc == c) // || (c == RGBA::NoAlpha && hc.a == 0.f))
-		{
-			if (state == MUST_FIND)
-				return true;
-		}
-		else if (hit.X >= this->size.W)
-			return false;
+		if (premultiplied)
+			Composite::Premultiply(BufferView(tmp));
 		else
-		{
-			if (state == MUST_ONLY_FIND)
-				return false;
-		}
+			Composite::Unpremultiply(BufferView(tmp));
 
-		if (dir == HORZ)
-			hit += Point((right) ? 1 : -1, 0);
-		else
-			hit += Point(0, (down) ? 1 : -1);
+		Composite::Blend(BufferView(*this, d), BufferView(tmp), o);
 	}
+	else
+		Composite::Blend(BufferView(*this, d), BufferView(from, s), o);
 
-	return (state == MUST_ONLY_FIND);
+	InvalidateFrom(d.top);
 }
 
-Rect Buffer::IsolateRect(const Rect& r, const Color& avoid)
+void Buffer::ResampleRectFromBuffer(const Rect& dst, const Rect& src, const Buffer& from, const Resample::Options& opt)
 {
-	Point notUsed; // will not be used but Scan() needs it in some other case.
+	Rect d = dst, s = src;
+	LimitRect(d);
+	from.LimitRect(s);
 
-	Rect lrc = r;
-	LimitRect(lrc);
-	
-	// Scan horizontally and go down until we hit something.
-	while (Scan(lrc.GetTopLeft(), lrc.GetTopRight(), HORZ, MUST_ONLY_FIND, avoid, notUsed))
-		lrc.top++;
+	if (d.left > d.right || d.top > d.bottom || s.left > s.right || s.top > s.bottom)
+		return;
 
-	// Scan vertically and go left until we hit something.
-	while (Scan(lrc.GetTopLeft(), lrc.GetBottomLeft(), VERT, MUST_ONLY_FIND, avoid, notUsed))
-		lrc.left++;
+	Resample::Options o = opt;
+	o.premultiplied = from.premultiplied;
 
-	// Scan horizontally and go upon until we hit something.
-	while (Scan(lrc.GetBottomLeft(), lrc.GetBottomRight(), HORZ, MUST_ONLY_FIND, avoid, notUsed))
-	{
-		lrc.bottom--;
+	BufferView to(*this, d);
+	Resample::Resize(to, BufferView(from, s), o);
 
-		if (lrc.bottom == lrc.top)
-		{
-			lrc.top--;
-			break;
-		}
+	if (from.premultiplied != premultiplied)
+	{
+		if (premultiplied)
+			Composite::Premultiply(to);
+		else
+			Composite::Unpremultiply(to);
 	}
 
-	// Scan vertically and go right until we hit something.
-	while (Scan(lrc.GetTopRight(), lrc.GetBottomRight(), VERT, MUST_ONLY_FIND, avoid, notUsed))
-		lrc.right--;
+	InvalidateFrom(d.top);
+}
+
+void Buffer::Resize(const Size& s, const Resample::Options& opt)
+{
+	Buffer out(s, RGBA::NoAlpha, format);
+	out.premultiplied = premultiplied;
+
+	if (s.W > 0 && s.H > 0)
+		out.ResampleRectFromBuffer(Rect(Point(0, 0), s), Rect(Point(0, 0), size), *this, opt);
+
+	bool indexed = occupancy != nullptr;
+	Mask m = (indexed) ? occupancy->GetMask() : Mask();
 
-	return lrc;
+	*this = std::move(out);
+
+	if (indexed)
+		IndexOccupancy(m);
 }
 
-bool Buffer::IsRectEmpty(const Rect& r, const Color& empty)
+void Buffer::Orient(Orientation::Op op)
 {
-	for (int y = r.top; y <= r.bottom; y++)
+	if (Orientation::Apply(BufferView(*this), op))
 	{
-		for (int x = r.left; x <= r.right; x++)
-		{
-			const Color& c = colors[y * size.W + x];
+		InvalidateFrom(0);
+		return;
+	}
 
-			if (empty == c)
-				continue;
+	Buffer out(Orientation::Result(size, op), RGBA::NoAlpha, format);
+	out.premultiplied = premultiplied;
 
-			if (empty == RGBA::NoAlpha && c.a == 0.f)
-				continue;
-				
-			return false;
-		}
-	}
+	Orientation::Apply(BufferView(out), BufferView(*this), op);
 
-	return true;
+	bool indexed = occupancy != nullptr;
+	Mask m = (indexed) ? occupancy->GetMask() : Mask();
+
+	*this = std::move(out);
+
+	if (indexed)
+		IndexOccupancy(m);
 }
 
-void Buffer::CopyLineFromBuffer(int dst, int src, int size,  const Buffer& from)
+bool Buffer::OrientRect(const Rect& r, Orientation::Op op)
 {
-	for (int i = 0; i <= size; i++, dst++, src++)
-		colors[dst] = from.colors[src];
+	Rect lr = r;
+	LimitRect(lr);
+
+	if (lr.left > lr.right || lr.top > lr.bottom)
+		return true;
+
+	if (!Orientation::Apply(BufferView(*this, lr), op))
+		return false;
+
+	InvalidateFrom(lr.top);
+	return true;
 }
 
-void Buffer::CopyRectFromBuffer(const Rect& dst, const Rect& src, const Buffer& from)
+Mipmap::Chain Buffer::Mipmaps(const Mipmap::Options& opt) const
 {
-	int left1 = dst.top * size.W + dst.left;
-	int right1 = dst.top * size.W + dst.right;
+	return Mipmap::Build(BufferView(*this), premultiplied, opt);
+}
 
-	int left2 = src.top * from.size.W + src.left;
-	int right2 = src.top * from.size.W + src.right;
-	int end = (src.bottom + 1) * from.size.W + src.left;
+void Buffer::Premultiply()
+{
+	if (premultiplied)
+		return;
 
-	while (left2 != end)
-	{
-		CopyLineFromBuffer(left1, left2, right1 - left1, from);
+	Composite::Premultiply(BufferView(*this));
+	premultiplied = true;
+	InvalidateFrom(0);
+}
 
-		left1 += size.W;
-		right1 += size.W;
+void Buffer::Unpremultiply()
+{
+	if (!premultiplied)
+		return;
 
-		left2 += from.size.W;
-		right2 += from.size.W;
-	}
+	Composite::Unpremultiply(BufferView(*this));
+	premultiplied = false;
+	InvalidateFrom(0);
 }
 
 void Buffer::GetData(std::vector<unsigned char> &data, size_t size) const
 {
 	data.clear();
+	data.resize(this->size.W * this->size.H * size);
 
-	unsigned char *r = nullptr;
-
-	if (size == 4)
-		r = rgba;
-	else
-		r = rgb;
+	PixelFormat to = (size == 4) ? RGBA8 : RGB8;
 
-	for (const auto &c : colors)
+	if (!premultiplied)
 	{
-		RGBA::ToRGBA(r, size, c);
-		data.push_back(r[0]);
-		data.push_back(r[1]);
-		data.push_back(r[2]);
+		Format::ConvertRow(format, bits, to, data.data(), this->size.W * this->size.H);
+		return;
+	}
 
-		if (size == 4)
-			data.push_back(r[3]);
+	// Straight, as Save writes it.
+	std::vector<Color> row(this->size.W);
+	size_t bpp = Format::BytesPerPixel(format);
+
+	for (int y = 0; y < this->size.H; y++)
+	{
+		Format::ConvertRow(format, bits + (size_t)y * this->size.W * bpp, RGBA32F, row.data(), this->size.W);
+		Composite::Unpremultiply(row.data(), row.size());
+		Format::ConvertRow(RGBA32F, row.data(), to, &data[(size_t)y * this->size.W * size], this->size.W);
 	}
 }
 
 void Buffer::Grayscale()
 {
-	auto dot = [](Color a, Color b) { return (a.r * b.r + a.g * b.g + a.b * b.b); };
+	PixelOps::Transform(BufferView(*this), [](auto w) { return ToGray(w); });
 
-	Color base(0.222f, 0.707, 0.071, 1.f);
+	InvalidateFrom(0);
+}
 
-	for (auto &c : colors)
-	{
-		float alpha = c.a;
-		c.a = (c = Color(dot(c, base))).a = alpha;
-	}
+Color Buffer::Average() const
+{
+	return Statistics().mean;
 }
 
-Color Buffer::Average()
+Stats::Result Buffer::Statistics(const Rect& r) const
 {
-	Color base = RGBA::Black;
-	int n = 0;
+	Rect lr = r;
+	LimitRect(lr);
 
-	for (const auto &c : colors)
-		base += c;
+	if (lr.left > lr.right || lr.top > lr.bottom)
+		return Stats::Result();
+
+	Stats::Result s = Stats::Compute(BufferView(*this, lr));
+
+	// Bounds in buffer coordinates.
+	if (s.covered)
+	{
+		s.bounds.left += lr.left;
+		s.bounds.right += lr.left;
+		s.bounds.top += lr.top;
+		s.bounds.bottom += lr.top;
+	}
 
-	return (base / (float)colors.size());
+	return s;
+}
+
+Stats::Result Buffer::Statistics() const
+{
+	return Stats::Compute(BufferView(*this));
 }
 
 void Buffer::FullAlpha(const Color& bg, float t)
 {
-	for (auto &c : colors)
-	{
-		if (c.a < t)
-			c = bg;
-	}
-}
\ No newline at end of file
+	PixelOps::Transform(BufferView(*this), [&](auto w) {
+		return (IsAlphaBelow(w, t)) ? Format::FromColor<decltype(w)>(bg) : w;
+	});
+
+	InvalidateFrom(0);
+}
@@ -14,12 +14,27 @@ Buffer class in which we manipulate the color data.
 
 #pragma once
 
+#include <future>
+#include <memory>
 #include <string>
 #include <vector>
 #include "color.h"
+#include "composite.h"
+#include "mappedfile.h"
+#include "mask.h"
+#include "mipmap.h"
+#include "occupancy.h"
+#include "orientation.h"
+#include "pixelformat.h"
+#include "pngwriter.h"
 #include "rect.h"
+#include "regions.h"
+#include "resample.h"
+#include "stats.h"
 #include <string>
 
+class BufferView;
+
 class PNG_Exception
 {
 	std::string strError;
@@ -42,33 +57,131 @@ class Buffer
 {
 protected:
 
-	std::vector<Color> colors;
+	PixelFormat format;
+	unsigned char *bits;				// size.W * size.H pixels of the format's type.
+	std::vector<unsigned char> bytes;	// Owned storage of bits, unless mapped.
+	std::unique_ptr<MappedFile> mapping;	// File bits point into, if any.
+	std::unique_ptr<OccupancyIndex> occupancy;
 	Size size;
+	bool premultiplied;					// Colors are stored multiplied by alpha.
+
+	void Allocate(size_t n);
+	void InvalidateFrom(int top);
+
+	void LimitPoint(Point &p) const;
+	void LimitRect(Rect &r) const;
 
-	void LimitPoint(Point &p);
-	void LimitRect(Rect &r);
+	void FlipRows();
+	void MirrorRows();
 
 	bool LoadFromTGA(const std::string &filename);
-	bool SaveAsTGA(const std::string &filename, bool with_alpha);
+	static bool SaveAsTGA(const BufferView &v, const std::string &filename, bool with_alpha, bool rle);
 	bool LoadFromPNG(const std::string &filename);
-	bool SaveAsPNG(const std::string &filename, bool with_alpha);
+	static bool SaveAsPNG(const BufferView &v, const std::string &filename, bool with_alpha, const PNGWriter::Options &opt);
+	bool LoadFrom2DL(const std::string &filename, const Rect *area);
+	static bool SaveAs2DL(const BufferView &v, const std::string &filename, bool tiled, unsigned short flags = 0);
 
 public:
 
 	enum ScanDirection { HORZ, VERT };
 	enum ScanState { MUST_FIND, MUST_ONLY_FIND };
 
-	Buffer();
-	Buffer(const Size& s, const Color& c);
+	Buffer(PixelFormat pf = RGBA32F);
+	Buffer(const Size& s, const Color& c, PixelFormat pf = RGBA32F);
+	Buffer(const Buffer& b);
+	Buffer(Buffer&& b);
+	Buffer& operator = (const Buffer& b);
+	Buffer& operator = (Buffer&& b);
+	// Fills with c, a straight color, keeping the alpha mode.
 	void Reset(const Size& s, const Color& c);
 	void Reset(const Color& c);
-	bool Save(const std::string &filename, bool with_alpha = true);
+
+	inline PixelFormat GetFormat() const
+	{
+		return format;
+	}
+
+	// Convert all pixels to another format.
+	void SetFormat(PixelFormat pf);
+
+	// Premultiplied buffers store colors multiplied by their alpha, which
+	// blends and filters without divides or leaking the color of transparent
+	// pixels.  Get() and Set() see the stored colors.  PNG and TGA files
+	// are saved straight, 2DL files keep the flag.
+	inline bool IsPremultiplied() const
+	{
+		return premultiplied;
+	}
+
+	void Premultiply();
+	void Unpremultiply();
+
+	// Typed access to the pixels.  F must be the traits of GetFormat().
+	template <class F>
+	inline typename F::Type *Pixels()
+	{
+		return reinterpret_cast<typename F::Type *>(bits);
+	}
+
+	template <class F>
+	inline const typename F::Type *Pixels() const
+	{
+		return reinterpret_cast<const typename F::Type *>(bits);
+	}
+
+	// Untyped access, rows of GetSize().W pixels of GetFormat().
+	inline unsigned char *GetBits()
+	{
+		return bits;
+	}
+
+	inline const unsigned char *GetBits() const
+	{
+		return bits;
+	}
+
+	// compress asks for RLE in TGA files, deflated tiles in 2DL files and the
+	// best zlib level in PNG files.  2DL files always keep the buffer's format and alpha.
+	bool Save(const std::string &filename, bool with_alpha = true, bool compress = false) const;
 	bool Load(const std::string &filename, bool with_alpha = true);
 
+	// Save a PNG with a given zlib level and row filter.
+	bool SavePNG(const std::string &filename, const PNGWriter::Options &opt, bool with_alpha = true) const;
+
+	// Save what a view looks at, the same way.
+	static bool Save(const BufferView &v, const std::string &filename, bool with_alpha = true, bool compress = false);
+	static bool SavePNG(const BufferView &v, const std::string &filename, const PNGWriter::Options &opt, bool with_alpha = true);
+
+	// Load or save on the shared thread pool.  A failed load throws from the
+	// future's get().  The buffer must not change until a save is done.
+	static std::future<Buffer> LoadAsync(const std::string &filename, PixelFormat pf = RGBA32F);
+	std::future<bool> SaveAsync(const std::string &filename, bool with_alpha = true, bool compress = false) const;
+
+	// Load only the part of an image inside r.  Only the tiles r touches are
+	// decoded from compressed 2DL files; other files are loaded whole and cropped.
+	bool LoadRect(const std::string &filename, const Rect& r);
+
+	// Load mode backed by the file itself: uncompressed 2DL files and
+	// uncompressed, top-down TGAs are mapped copy-on-write and used in place,
+	// in the file's format.
+	// Pixels are only read from disk when touched, and changes never reach
+	// the file.  Other files are loaded with Load().  Copies of a mapped
+	// buffer own their pixels.
+	bool Map(const std::string &filename);
+
+	inline bool IsMapped() const
+	{
+		return mapping != nullptr;
+	}
+
 	void Sanitize();
 
 	void Set(const Point &p, const Color& c);
-	const Color& Get(const Point &p) const;
+	Color Get(const Point &p) const;
+
+	// Access as packed pixels, converted on the fly for other formats.
+	void SetPixel(const Point &p, const Pixel& px);
+	Pixel GetPixel(const Point &p) const;
 
 	void DrawHorizontalLine(const Point &p, const Point &q, const Color& c);
 	void DrawVerticalLine(const Point& start, const Point& end, const Color& c);
@@ -76,12 +189,55 @@ public:
 	void DrawRect(const Rect& r, const Color &c);
 	void FillRect(const Rect& r, const Color& c);
 	bool Scan(const Point &start, const Point &end, ScanDirection dir, ScanState s, const Color &c, Point& hit);
+
+	// Tight rect around the content of r, m telling what content is.  Has no
+	// size when there is none.  IsolateRect() is Trim() of what isn't avoid.
+	Rect Trim(const Rect& r, const Mask& m) const;
 	Rect IsolateRect(const Rect& r, const Color& avoid);
+
+	// Keep a summed-area table of what m counts as content, so CountOccupied()
+	// with m, and IsRectEmpty() with the matching color (NoAlpha matches
+	// AlphaAbove(0) when the format has alpha), take constant time.  Buffer's
+	// own methods keep it up to date; call Touched() after writing through Pixels().
+	// Changed rows are summed again by the next query, under a lock, so
+	// threads can query a const Buffer at the same time.
+	void IndexOccupancy(const Mask& m);
+	void DropOccupancyIndex();
+	void Touched(const Rect& r);
+	unsigned int CountOccupied(const Rect& r, const Mask& m) const;
+
+	// Content hash of the pixels in r, or of all of them.  Equal for the same
+	// size, format and pixels, wherever they are.
+	unsigned long long Hash(const Rect& r) const;
+	unsigned long long Hash() const;
+
+	// Rects of the connected regions of what m counts as content, such as the
+	// sprites on a sheet.
+	std::vector<Rect> FindRegions(const Mask& m, const Regions::Options& opt = Regions::Options()) const;
 	bool IsRectEmpty(const Rect& r, const Color& empty = RGBA::NoAlpha);
 
+	// Copies size + 1 pixels, converting the format and the alpha mode.
 	void CopyLineFromBuffer(int dst, int src, int size, const Buffer& from);
+
+	// Copies src of from to dst, converting the format and the alpha mode.
+	// Both rects are clipped and the copy is the size of the smaller one.
+	// from can be this buffer, with overlapping rects.
 	void CopyRectFromBuffer(const Rect& dst, const Rect& src, const Buffer& from);
 
+	// Scales src of from to fill dst.  Both rects are clipped to their
+	// buffers, and from can be this buffer.
+	void ResampleRectFromBuffer(const Rect& dst, const Rect& src, const Buffer& from, const Resample::Options& opt = Resample::Options());
+
+	// Flips, turns or transposes src of from into dst, converting the format
+	// and the alpha mode.  Both rects are clipped to their buffers and the
+	// result fills dst from its top left corner, as far as it goes.  from
+	// can be this buffer, with overlapping rects.
+	void OrientRectFromBuffer(const Rect& dst, const Rect& src, const Buffer& from, Orientation::Op op);
+
+	// Composites src of from onto dst, clipped the same way.  The buffers'
+	// own alpha modes are used, whatever opt.premultiplied says.
+	void BlendRectFromBuffer(const Rect& dst, const Rect& src, const Buffer& from, const Composite::Options& opt = Composite::Options());
+
 	inline Size GetSize() const
 	{
 		return size;
@@ -89,9 +245,31 @@ public:
 
 	void FullAlpha(const Color& c, float t = 1.f);
 
+	// The pixels as straight 8 bit RGB (size 3) or RGBA (size 4), like Save.
 	void GetData(std::vector<unsigned char> &data, size_t size) const;
 
 	void Grayscale();
 
-	Color Average();
+	// Scales the whole buffer to a new size, keeping its format and alpha mode.
+	void Resize(const Size& s, const Resample::Options& opt = Resample::Options());
+
+	// Flips, turns or transposes the whole buffer.  Turns that change the
+	// size reallocate, keeping the format, alpha mode and occupancy mask.
+	void Orient(Orientation::Op op);
+
+	// The same on r, clipped, in place.  Turns need a square r: returns
+	// false and leaves the pixels alone otherwise.
+	bool OrientRect(const Rect& r, Orientation::Op op);
+
+	// This buffer and its halvings down to 1x1, in its format and alpha mode,
+	// in one allocation.
+	Mipmap::Chain Mipmaps(const Mipmap::Options& opt = Mipmap::Options()) const;
+
+	// Mean color, transparent black for an empty buffer.
+	Color Average() const;
+
+	// Mean, min and max, histograms, coverage and bounds of the pixels in r,
+	// or of all of them, in one pass.
+	Stats::Result Statistics(const Rect& r) const;
+	Stats::Result Statistics() const;
 };
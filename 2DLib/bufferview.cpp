@@ -0,0 +1,304 @@
+/* --------------------------------------------------------------------------
+
+bufferview.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+A window on pixels owned by someone else.
+
+-----------------------------------------------------------------------------*/
+
+#include "bufferview.h"
+#include "hash.h"
+#include "trim.h"
+#include <algorithm>
+
+static const Color nullColor;
+
+BufferView::BufferView()
+	: bits(nullptr)
+	, stride(0)
+	, format(RGBA32F)
+{
+
+}
+
+BufferView::BufferView(void *b, const Size& s, PixelFormat pf, size_t st)
+	: bits((unsigned char *)b)
+	, size(s)
+	, stride((st) ? st : s.W * Format::BytesPerPixel(pf))
+	, format(pf)
+{
+
+}
+
+BufferView::BufferView(Buffer& b)
+	: BufferView(b.GetBits(), b.GetSize(), b.GetFormat())
+{
+
+}
+
+BufferView::BufferView(const Buffer& b)
+	: BufferView(const_cast<unsigned char *>(b.GetBits()), b.GetSize(), b.GetFormat())
+{
+
+}
+
+BufferView::BufferView(Buffer& b, const Rect& r)
+	: BufferView(BufferView(b).Sub(r))
+{
+
+}
+
+BufferView::BufferView(const Buffer& b, const Rect& r)
+	: BufferView(BufferView(b).Sub(r))
+{
+
+}
+
+BufferView BufferView::Sub(const Rect& r) const
+{
+	Rect lr = r;
+	LimitRect(lr);
+
+	if (lr.left > lr.right || lr.top > lr.bottom)
+		return BufferView(bits, Size(0, 0), format, stride);
+
+	return BufferView(bits + lr.top * stride + lr.left * Format::BytesPerPixel(format), Size(lr.GetWidth(), lr.GetHeight()), format, stride);
+}
+
+void BufferView::LimitPoint(Point& p) const
+{
+	p.X = std::max(0, std::min(p.X, size.W - 1));
+	p.Y = std::max(0, std::min(p.Y, size.H - 1));
+}
+
+void BufferView::LimitRect(Rect& r) const
+{
+	r.left = std::max(r.left, 0);
+	r.top = std::max(r.top, 0);
+	r.right = std::min(r.right, size.W - 1);
+	r.bottom = std::min(r.bottom, size.H - 1);
+}
+
+Color BufferView::Get(const Point& p) const
+{
+	if (p.X >= 0 && p.X < size.W && p.Y >= 0 && p.Y < size.H)
+	{
+		return Format::Dispatch(format, [&](auto f) {
+			typedef decltype(f) F;
+			return Format::Load<F>(Row<F>(p.Y)[p.X]);
+		});
+	}
+
+	return nullColor;
+}
+
+void BufferView::Set(const Point& p, const Color& c) const
+{
+	if (p.X >= 0 && p.X < size.W && p.Y >= 0 && p.Y < size.H)
+	{
+		Format::Dispatch(format, [&](auto f) {
+			typedef decltype(f) F;
+			Row<F>(p.Y)[p.X] = Format::Store<F>(c);
+		});
+	}
+}
+
+void BufferView::Fill(const Color& c) const
+{
+	FillRect(Rect(Point(0, 0), size), c);
+}
+
+void BufferView::FillRect(const Rect& r, const Color& c) const
+{
+	Rect lr = r;
+	LimitRect(lr);
+
+	if (lr.left > lr.right || lr.top > lr.bottom)
+		return;
+
+	Format::Dispatch(format, [&](auto f) {
+		typedef decltype(f) F;
+		const typename F::Type v = Format::Store<F>(c);
+
+		for (int y = lr.top; y <= lr.bottom; y++)
+			std::fill(Row<F>(y) + lr.left, Row<F>(y) + lr.right + 1, v);
+	});
+}
+
+void BufferView::DrawRect(const Rect& r, const Color& c) const
+{
+	Rect lr = r;
+	LimitRect(lr);
+
+	Point p1 = lr.GetTopLeft(), p2 = lr.GetTopRight(), p3 = lr.GetBottomLeft(), p4 = lr.GetBottomRight();
+
+	DrawHorizontalLine(p1, p2, c);
+	DrawHorizontalLine(p3, p4, c);
+
+	DrawVerticalLine(p1, p3, c);
+	DrawVerticalLine(p2, p4, c);
+}
+
+void BufferView::DrawHorizontalLine(const Point& start, const Point& end, const Color& c) const
+{
+	if (IsEmpty())
+		return;
+
+	Point s = start, e = end;
+
+	LimitPoint(s);
+	LimitPoint(e);
+
+	// Same Y, start is smaller than end.
+	if (s.Y == e.Y && s.X <= e.X)
+	{
+		Format::Dispatch(format, [&](auto f) {
+			typedef decltype(f) F;
+			std::fill(Row<F>(s.Y) + s.X, Row<F>(s.Y) + e.X + 1, Format::Store<F>(c));
+		});
+	}
+}
+
+void BufferView::DrawVerticalLine(const Point& start, const Point& end, const Color& c) const
+{
+	if (IsEmpty())
+		return;
+
+	Point s = start, e = end;
+
+	LimitPoint(s);
+	LimitPoint(e);
+
+	// Same X, start is smaller than end.
+	if (s.X == e.X && s.Y <= e.Y)
+	{
+		Format::Dispatch(format, [&](auto f) {
+			typedef decltype(f) F;
+			const typename F::Type v = Format::Store<F>(c);
+
+			for (int y = s.Y; y <= e.Y; y++)
+				Row<F>(y)[s.X] = v;
+		});
+	}
+}
+
+bool BufferView::Scan(const Point& start, const Point& end, Buffer::ScanDirection dir, Buffer::ScanState state, const Color& c, Point& hit) const
+{
+	bool right = (start.X <= end.X);
+	bool down = (start.Y <= end.Y);
+
+	hit = start;
+	Point stop = end;
+
+	return Format::Dispatch(format, [&](auto f) {
+		typedef decltype(f) F;
+		const typename F::Work target = Format::Quantize<F>(c);
+
+		// Outside of the view, we read the same as Get() does.
+		const bool outside_same = (Format::Quantize<F>(nullColor) == target);
+
+		while (hit != stop)
+		{
+			bool inside = (hit.X >= 0 && hit.X < size.W && hit.Y >= 0 && hit.Y < size.H);
+			bool same = (inside) ? (F::ToWork(Row<F>(hit.Y)[hit.X]) == target) : outside_same;
+
+			if (same)
+			{
+				if (state == Buffer::MUST_FIND)
+					return true;
+			}
+			else if (hit.X >= size.W)
+				return false;
+			else
+			{
+				if (state == Buffer::MUST_ONLY_FIND)
+					return false;
+			}
+
+			if (dir == Buffer::HORZ)
+				hit += Point((right) ? 1 : -1, 0);
+			else
+				hit += Point(0, (down) ? 1 : -1);
+		}
+
+		return (state == Buffer::MUST_ONLY_FIND);
+	});
+}
+
+bool BufferView::IsRectEmpty(const Rect& r, const Color& empty) const
+{
+	bool no_alpha = (empty == RGBA::NoAlpha);
+
+	Rect lr = r;
+	LimitRect(lr);
+
+	return Format::Dispatch(format, [&](auto f) {
+		typedef decltype(f) F;
+		const typename F::Work target = Format::Quantize<F>(empty);
+
+		for (int y = lr.top; y <= lr.bottom; y++)
+		{
+			const auto *px = Row<F>(y);
+
+			for (int x = lr.left; x <= lr.right; x++)
+			{
+				const typename F::Work c = F::ToWork(px[x]);
+
+				if (target == c)
+					continue;
+
+				if (no_alpha && Format::IsTransparent(c))
+					continue;
+
+				return false;
+			}
+		}
+
+		return true;
+	});
+}
+
+Rect BufferView::Trim(const Rect& r, const Mask& m) const
+{
+	Rect lr = r;
+	LimitRect(lr);
+
+	if (lr.right < lr.left || lr.bottom < lr.top)
+		return Rect(lr.GetTopLeft(), Size(0, 0));
+
+	return Trim::Bounds(bits, stride, format, lr, m);
+}
+
+std::vector<Rect> BufferView::FindRegions(const Mask& m, const Regions::Options& opt) const
+{
+	std::vector<Rect> rects;
+
+	for (const Regions::Region &r : Regions::Find(bits, size, stride, format, m, opt))
+		rects.push_back(r.rect);
+
+	return rects;
+}
+
+unsigned long long BufferView::Hash() const
+{
+	return Hash::Region(bits, stride, format, Rect(Point(0, 0), size));
+}
+
+void BufferView::CopyFrom(const BufferView& src) const
+{
+	int w = std::min(size.W, src.size.W), h = std::min(size.H, src.size.H);
+
+	for (int y = 0; y < h; y++)
+		Format::ConvertRow(src.format, src.Row(y), format, Row(y), std::max(w, 0));
+}
+
+bool BufferView::Save(const std::string& filename, bool with_alpha, bool compress) const
+{
+	return Buffer::Save(*this, filename, with_alpha, compress);
+}
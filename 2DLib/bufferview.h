@@ -0,0 +1,97 @@
+/* --------------------------------------------------------------------------
+
+bufferview.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+A window on pixels owned by someone else: a pointer, a size, the distance
+between rows and a format.  It can look at a rect of a Buffer or at outside
+memory, and crops, draws, trims, hashes, converts and saves without
+allocating or copying the pixels.
+
+Like a pointer, a view doesn't keep what it looks at alive, and const only
+means the view itself doesn't change.  A view made from a const Buffer must
+only be read from.  Buffer's own drawing, scanning, trimming and saving are
+done through views of itself.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "buffer.h"
+
+class BufferView
+{
+protected:
+
+	unsigned char *bits;
+	Size size;
+	size_t stride;			// Bytes from one row to the next.
+	PixelFormat format;
+
+public:
+
+	BufferView();
+
+	// stride 0 means rows without gaps.
+	BufferView(void *bits, const Size& s, PixelFormat pf, size_t stride = 0);
+
+	// All of b, or r of it, clipped to b.
+	BufferView(Buffer& b);
+	BufferView(const Buffer& b);
+	BufferView(Buffer& b, const Rect& r);
+	BufferView(const Buffer& b, const Rect& r);
+
+	// r of this view, clipped to it.
+	BufferView Sub(const Rect& r) const;
+
+	inline Size GetSize() const { return size; }
+	inline PixelFormat GetFormat() const { return format; }
+	inline size_t GetStride() const { return stride; }
+	inline bool IsEmpty() const { return size.W <= 0 || size.H <= 0; }
+
+	// Rows follow each other without gaps.
+	inline bool IsContiguous() const { return stride == size.W * Format::BytesPerPixel(format); }
+
+	inline unsigned char *Row(int y) const
+	{
+		return bits + y * stride;
+	}
+
+	template <class F>
+	inline typename F::Type *Row(int y) const
+	{
+		return reinterpret_cast<typename F::Type *>(bits + y * stride);
+	}
+
+	// Same behaviour as Buffer's.
+	Color Get(const Point& p) const;
+	void Set(const Point& p, const Color& c) const;
+	void Fill(const Color& c) const;
+	void FillRect(const Rect& r, const Color& c) const;
+	void DrawRect(const Rect& r, const Color& c) const;
+	void DrawHorizontalLine(const Point& start, const Point& end, const Color& c) const;
+	void DrawVerticalLine(const Point& start, const Point& end, const Color& c) const;
+	bool Scan(const Point& start, const Point& end, Buffer::ScanDirection dir, Buffer::ScanState state, const Color& c, Point& hit) const;
+	bool IsRectEmpty(const Rect& r, const Color& empty = RGBA::NoAlpha) const;
+	Rect Trim(const Rect& r, const Mask& m) const;
+	std::vector<Rect> FindRegions(const Mask& m, const Regions::Options& opt = Regions::Options()) const;
+	unsigned long long Hash() const;
+
+	// Copies src into this view from the top left corner, converting the
+	// format, as far as both go.
+	void CopyFrom(const BufferView& src) const;
+
+	bool Save(const std::string& filename, bool with_alpha = true, bool compress = false) const;
+
+protected:
+
+	void LimitPoint(Point& p) const;
+	void LimitRect(Rect& r) const;
+};
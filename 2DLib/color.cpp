@@ -12,41 +12,433 @@ A Color data type based on glm with constants.
 
 -----------------------------------------------------------------------------*/
 #include "color.h"
+#include "simd.h"
+#include <cstring>
 
 void RGBA::FromBGRA(Color &dst, const unsigned char *src, size_t size)
 {
-	dst.b = (float)src[0] / 255.f;
-	dst.g = (float)src[1] / 255.f;
-	dst.r = (float)src[2] / 255.f;
-	dst.a = (size == 4) ? (float)src[3] / 255.f : 0.f;
+	Pixel p = { src[2], src[1], src[0], (unsigned char)((size == 4) ? src[3] : 255) };
+	dst = Unpack(p);
 }
 
 void RGBA::FromRGBA(Color &dst, const unsigned char *src, size_t size)
 {
-	dst.r = (float)src[0] / 255.f;
-	dst.g = (float)src[1] / 255.f;
-	dst.b = (float)src[2] / 255.f;
-	dst.a = (size == 4) ? (float)src[3] / 255.f : 0.f;
+	Pixel p = { src[0], src[1], src[2], (unsigned char)((size == 4) ? src[3] : 255) };
+	dst = Unpack(p);
 }
 
 void RGBA::ToBGRA(unsigned char *dst, size_t size, const Color& src)
 {
-	dst[0] = (unsigned char)(src.b * 255.f);
-	dst[1] = (unsigned char)(src.g * 255.f);
-	dst[2] = (unsigned char)(src.r * 255.f);
+	dst[0] = PackChannel(src.b);
+	dst[1] = PackChannel(src.g);
+	dst[2] = PackChannel(src.r);
 
 	if (size == 4)
-		dst[3] = (unsigned char)(src.a * 255.f);
+		dst[3] = PackChannel(src.a);
 }
 
 void RGBA::ToRGBA(unsigned char *dst, size_t size, const Color& src)
 {
-	dst[0] = (unsigned char)(src.r * 255.f);
-	dst[1] = (unsigned char)(src.g * 255.f);
-	dst[2] = (unsigned char)(src.b * 255.f);
+	dst[0] = PackChannel(src.r);
+	dst[1] = PackChannel(src.g);
+	dst[2] = PackChannel(src.b);
 
 	if (size == 4)
-		dst[3] = (unsigned char)(src.a * 255.f);
+		dst[3] = PackChannel(src.a);
+}
+
+// --- Bulk conversions ------------------------------------------------------
+//
+// Each kernel is a template over the number of components S (3 or 4) and the
+// byte order, so the loops carry no branches.  The SIMD versions do as many
+// pixels as they safely can and leave the tail to the scalar version.
+
+template <size_t S, bool BGR>
+static void FromRowScalar(Color *dst, const unsigned char *src, size_t n)
+{
+	for (size_t i = 0; i < n; i++, src += S)
+	{
+		Pixel p = { src[BGR ? 2 : 0], src[1], src[BGR ? 0 : 2], (unsigned char)((S == 4) ? src[S - 1] : 255) };
+		dst[i] = RGBA::Unpack(p);
+	}
+}
+
+template <size_t S, bool BGR>
+static void ToRowScalar(unsigned char *dst, const Color *src, size_t n)
+{
+	for (size_t i = 0; i < n; i++, dst += S)
+	{
+		Pixel p = RGBA::Pack(src[i]);
+
+		dst[0] = BGR ? p.b : p.r;
+		dst[1] = p.g;
+		dst[2] = BGR ? p.r : p.b;
+
+		if (S == 4)
+			dst[S - 1] = p.a;
+	}
+}
+
+template <size_t DS, size_t SS, bool SWAP>
+static void SwizzleRowScalar(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	for (size_t i = 0; i < n; i++, dst += DS, src += SS)
+	{
+		unsigned char r = src[SWAP ? 2 : 0], g = src[1], b = src[SWAP ? 0 : 2];
+
+		dst[0] = r;
+		dst[1] = g;
+		dst[2] = b;
+
+		if (DS == 4)
+			dst[DS - 1] = (SS == 4) ? src[SS - 1] : 255;
+	}
+}
+
+#ifdef SIMD_X86
+
+// Swap red and blue of a float pixel.
+#define SHUFFLE_BGR _MM_SHUFFLE(3, 0, 1, 2)
+
+template <size_t S, bool BGR>
+SIMD_SSE2 static void FromRowSSE2(Color *dst, const unsigned char *src, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(1.f / 255.f);
+	size_t i = 0;
+
+	if (S == 4)
+	{
+		// 4 pixels at a time: bytes -> words -> dwords -> floats.
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			__m128 p[4] = {
+				_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)),
+				_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero))
+			};
+
+			for (int k = 0; k < 4; k++)
+			{
+				if (BGR)
+					p[k] = _mm_shuffle_ps(p[k], p[k], SHUFFLE_BGR);
+
+				_mm_storeu_ps((float *)(dst + i + k), _mm_mul_ps(p[k], scale));
+			}
+		}
+	}
+	else
+	{
+		// One pixel at a time, assembled with an opaque alpha.
+		for (; i < n; i++)
+		{
+			const unsigned char *s = src + i * 3;
+			int v = (int)(s[0] | (s[1] << 8) | (s[2] << 16) | 0xFF000000u);
+			__m128i w = _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero);
+			__m128 p = _mm_cvtepi32_ps(_mm_unpacklo_epi16(w, zero));
+
+			if (BGR)
+				p = _mm_shuffle_ps(p, p, SHUFFLE_BGR);
+
+			_mm_storeu_ps((float *)(dst + i), _mm_mul_ps(p, scale));
+		}
+	}
+
+	FromRowScalar<S, BGR>(dst + i, src + i * S, n - i);
+}
+
+template <size_t S, bool BGR>
+SIMD_SSE2 static void ToRowSSE2(unsigned char *dst, const Color *src, size_t n)
+{
+	const __m128 scale = _mm_set1_ps(255.f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	size_t i = 0;
+
+	// 4 pixels at a time: floats -> dwords -> saturated words -> saturated bytes.
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i d[4];
+
+		for (int k = 0; k < 4; k++)
+		{
+			__m128 p = _mm_loadu_ps((const float *)(src + i + k));
+
+			if (BGR)
+				p = _mm_shuffle_ps(p, p, SHUFFLE_BGR);
+
+			d[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(p, scale), half));
+		}
+
+		__m128i out = _mm_packus_epi16(_mm_packs_epi32(d[0], d[1]), _mm_packs_epi32(d[2], d[3]));
+
+		if (S == 4)
+			_mm_storeu_si128((__m128i *)(dst + i * 4), out);
+		else
+		{
+			unsigned char tmp[16];
+			_mm_storeu_si128((__m128i *)tmp, out);
+
+			for (int k = 0; k < 4; k++)
+				memcpy(dst + (i + k) * 3, tmp + k * 4, 3);
+		}
+	}
+
+	ToRowScalar<S, BGR>(dst + i * S, src + i, n - i);
+}
+
+template <size_t DS, size_t SS, bool SWAP>
+SIMD_SSE2 static void SwizzleRowSSE2(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	size_t i = 0;
+
+	// Without pshufb, only the 4 -> 4 case is worth doing in registers.
+	if (DS == 4 && SS == 4)
+	{
+		const __m128i ga = _mm_set1_epi32((int)0xFF00FF00);
+		const __m128i lo = _mm_set1_epi32(0xFF);
+
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+
+			if (SWAP)
+				v = _mm_or_si128(_mm_and_si128(v, ga),
+					_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), lo), _mm_slli_epi32(_mm_and_si128(v, lo), 16)));
+
+			_mm_storeu_si128((__m128i *)(dst + i * 4), v);
+		}
+	}
+
+	SwizzleRowScalar<DS, SS, SWAP>(dst + i * DS, src + i * SS, n - i);
+}
+
+template <size_t S, bool BGR>
+SIMD_AVX2 static void FromRowAVX2(Color *dst, const unsigned char *src, size_t n)
+{
+	const __m256 scale = _mm256_set1_ps(1.f / 255.f);
+	size_t i = 0;
+
+	if (S == 3)
+	{
+		// Expand 4 RGB pixels to RGBA with pshufb; 16 byte loads need 4 bytes of slack.
+		const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+		for (; i + 6 <= n; i += 4)
+		{
+			__m128i v = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * 3)), expand), alpha);
+			__m256 p0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+			__m256 p1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+
+			if (BGR)
+			{
+				p0 = _mm256_shuffle_ps(p0, p0, SHUFFLE_BGR);
+				p1 = _mm256_shuffle_ps(p1, p1, SHUFFLE_BGR);
+			}
+
+			_mm256_storeu_ps((float *)(dst + i), _mm256_mul_ps(p0, scale));
+			_mm256_storeu_ps((float *)(dst + i + 2), _mm256_mul_ps(p1, scale));
+		}
+	}
+	else
+	{
+		// 2 pixels per register: 8 bytes -> 8 dwords -> 8 floats.
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+			__m256 p0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+			__m256 p1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+
+			if (BGR)
+			{
+				p0 = _mm256_shuffle_ps(p0, p0, SHUFFLE_BGR);
+				p1 = _mm256_shuffle_ps(p1, p1, SHUFFLE_BGR);
+			}
+
+			_mm256_storeu_ps((float *)(dst + i), _mm256_mul_ps(p0, scale));
+			_mm256_storeu_ps((float *)(dst + i + 2), _mm256_mul_ps(p1, scale));
+		}
+	}
+
+	FromRowScalar<S, BGR>(dst + i, src + i * S, n - i);
+}
+
+template <size_t S, bool BGR>
+SIMD_AVX2 static void ToRowAVX2(unsigned char *dst, const Color *src, size_t n)
+{
+	const __m256 scale = _mm256_set1_ps(255.f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256 p0 = _mm256_loadu_ps((const float *)(src + i));
+		__m256 p1 = _mm256_loadu_ps((const float *)(src + i + 2));
+
+		if (BGR)
+		{
+			p0 = _mm256_shuffle_ps(p0, p0, SHUFFLE_BGR);
+			p1 = _mm256_shuffle_ps(p1, p1, SHUFFLE_BGR);
+		}
+
+		__m256i d0 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(p0, scale), half));
+		__m256i d1 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(p1, scale), half));
+
+		__m128i w0 = _mm_packs_epi32(_mm256_castsi256_si128(d0), _mm256_extracti128_si256(d0, 1));
+		__m128i w1 = _mm_packs_epi32(_mm256_castsi256_si128(d1), _mm256_extracti128_si256(d1, 1));
+		__m128i out = _mm_packus_epi16(w0, w1);
+
+		if (S == 4)
+			_mm_storeu_si128((__m128i *)(dst + i * 4), out);
+		else
+		{
+			out = _mm_shuffle_epi8(out, compact);
+			_mm_storel_epi64((__m128i *)(dst + i * 3), out);
+
+			int last = _mm_cvtsi128_si32(_mm_srli_si128(out, 8));
+			memcpy(dst + i * 3 + 8, &last, 4);
+		}
+	}
+
+	ToRowScalar<S, BGR>(dst + i * S, src + i, n - i);
+}
+
+template <size_t DS, size_t SS, bool SWAP>
+SIMD_AVX2 static void SwizzleRowAVX2(unsigned char *dst, const unsigned char *src, size_t n)
+{
+	// Build the pshufb mask for 4 pixels; -1 (0x80) zeroes a byte, which the
+	// alpha mask then fills in when the source has no alpha.
+	char m[16], a[16];
+
+	for (int k = 0; k < 16; k++)
+		m[k] = a[k] = 0;
+
+	for (int p = 0; p < 4; p++)
+	{
+		for (int c = 0; c < (int)DS; c++)
+		{
+			int sc = (SWAP && c != 1 && c != 3) ? 2 - c : c;
+
+			if (c == 3 && SS == 3)
+			{
+				m[p * DS + c] = -1;
+				a[p * DS + c] = -1;
+			}
+			else
+				m[p * DS + c] = (char)(p * SS + sc);
+		}
+	}
+
+	for (int k = DS * 4; k < 16; k++)
+		m[k] = -1;
+
+	const __m128i mask = _mm_loadu_si128((const __m128i *)m);
+	const __m128i alpha = _mm_loadu_si128((const __m128i *)a);
+	size_t i = 0;
+
+	// 16 byte loads of 4 pixels; 3 byte sources need 4 bytes of slack.
+	for (; i + 4 <= n && (i + 4) * SS + (16 - 4 * SS) <= n * SS; i += 4)
+	{
+		__m128i v = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i * SS)), mask), alpha);
+
+		if (DS == 4)
+			_mm_storeu_si128((__m128i *)(dst + i * 4), v);
+		else
+		{
+			_mm_storel_epi64((__m128i *)(dst + i * 3), v);
+
+			int last = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+			memcpy(dst + i * 3 + 8, &last, 4);
+		}
+	}
+
+	SwizzleRowScalar<DS, SS, SWAP>(dst + i * DS, src + i * SS, n - i);
+}
+
+#undef SHUFFLE_BGR
+
+#endif
+
+// Pick the best version once per kernel.
+
+template <size_t S, bool BGR>
+static void FromRow(Color *dst, const unsigned char *src, size_t n)
+{
+#ifdef SIMD_X86
+	static void (* const fn)(Color *, const unsigned char *, size_t) = SIMD::HasAVX2() ? &FromRowAVX2<S, BGR> : &FromRowSSE2<S, BGR>;
+	fn(dst, src, n);
+#else
+	FromRowScalar<S, BGR>(dst, src, n);
+#endif
+}
+
+template <size_t S, bool BGR>
+static void ToRow(unsigned char *dst, const Color *src, size_t n)
+{
+#ifdef SIMD_X86
+	static void (* const fn)(unsigned char *, const Color *, size_t) = SIMD::HasAVX2() ? &ToRowAVX2<S, BGR> : &ToRowSSE2<S, BGR>;
+	fn(dst, src, n);
+#else
+	ToRowScalar<S, BGR>(dst, src, n);
+#endif
+}
+
+template <size_t DS, size_t SS, bool SWAP>
+static void SwizzleRow(unsigned char *dst, const unsigned char *src, size_t n)
+{
+#ifdef SIMD_X86
+	static void (* const fn)(unsigned char *, const unsigned char *, size_t) = SIMD::HasAVX2() ? &SwizzleRowAVX2<DS, SS, SWAP> : &SwizzleRowSSE2<DS, SS, SWAP>;
+	fn(dst, src, n);
+#else
+	SwizzleRowScalar<DS, SS, SWAP>(dst, src, n);
+#endif
+}
+
+void RGBA::FromBGRA(Color *dst, const unsigned char *src, size_t size, size_t n)
+{
+	if (size == 4)
+		FromRow<4, true>(dst, src, n);
+	else
+		FromRow<3, true>(dst, src, n);
+}
+
+void RGBA::FromRGBA(Color *dst, const unsigned char *src, size_t size, size_t n)
+{
+	if (size == 4)
+		FromRow<4, false>(dst, src, n);
+	else
+		FromRow<3, false>(dst, src, n);
+}
+
+void RGBA::ToBGRA(unsigned char *dst, size_t size, const Color *src, size_t n)
+{
+	if (size == 4)
+		ToRow<4, true>(dst, src, n);
+	else
+		ToRow<3, true>(dst, src, n);
+}
+
+void RGBA::ToRGBA(unsigned char *dst, size_t size, const Color *src, size_t n)
+{
+	if (size == 4)
+		ToRow<4, false>(dst, src, n);
+	else
+		ToRow<3, false>(dst, src, n);
+}
+
+void RGBA::Swizzle(unsigned char *dst, size_t dst_size, const unsigned char *src, size_t src_size, bool swap_rb, size_t n)
+{
+	if (dst_size == 4 && src_size == 4)
+		(swap_rb) ? SwizzleRow<4, 4, true>(dst, src, n) : SwizzleRow<4, 4, false>(dst, src, n);
+	else if (dst_size == 4)
+		(swap_rb) ? SwizzleRow<4, 3, true>(dst, src, n) : SwizzleRow<4, 3, false>(dst, src, n);
+	else if (src_size == 4)
+		(swap_rb) ? SwizzleRow<3, 4, true>(dst, src, n) : SwizzleRow<3, 4, false>(dst, src, n);
+	else
+		(swap_rb) ? SwizzleRow<3, 3, true>(dst, src, n) : SwizzleRow<3, 3, false>(dst, src, n);
 }
 
 std::ostream & operator << (std::ostream &os, const Color &c)
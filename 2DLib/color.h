@@ -19,6 +19,15 @@ A Color data type based on glm with constants.
 
 typedef glm::vec4 Color;
 
+// A packed 8 bits per channel color, stored in R, G, B, A order (4 bytes).
+struct Pixel
+{
+	unsigned char r, g, b, a;
+
+	bool operator == (const Pixel& p) const { return r == p.r && g == p.g && b == p.b && a == p.a; }
+	bool operator != (const Pixel& p) const { return !(*this == p); }
+};
+
 namespace RGBA
 {
 	static const Color NoAlpha(0.f, 0.f, 0.f, 0.f);
@@ -32,10 +41,41 @@ namespace RGBA
 	static const Color Magenta(1.f, 0.f, 1.f, 1.f);
 	static const Color Cyan(0.f, 1.f, 1.f, 1.f);
 
+	// One pixel of size 3 or 4 bytes.  With 3 components, alpha reads as opaque.
+	// Floats are clamped and rounded like Pack().
 	void FromBGRA(Color &dest, const unsigned char *src, size_t size);
 	void FromRGBA(Color &dest, const unsigned char *src, size_t size);
 	void ToBGRA(unsigned char *dst, size_t size, const Color& src);
 	void ToRGBA(unsigned char *dst, size_t size, const Color& src);
+
+	// Bulk versions over rows of n pixels, picking SSE2 or AVX2 at run time.
+	// Same results as the single pixel versions.
+	void FromBGRA(Color *dst, const unsigned char *src, size_t size, size_t n);
+	void FromRGBA(Color *dst, const unsigned char *src, size_t size, size_t n);
+	void ToBGRA(unsigned char *dst, size_t size, const Color *src, size_t n);
+	void ToRGBA(unsigned char *dst, size_t size, const Color *src, size_t n);
+
+	// 8 bit reordering between 3 or 4 component pixels, swapping red and blue
+	// if asked.  A missing alpha becomes opaque.
+	void Swizzle(unsigned char *dst, size_t dst_size, const unsigned char *src, size_t src_size, bool swap_rb, size_t n);
+
+	// Conversions between float colors and packed pixels.  Clamped and rounded
+	// so that a Pack(Unpack(p)) round trip is exact.
+	inline unsigned char PackChannel(float f)
+	{
+		return (f <= 0.f) ? 0 : (f >= 1.f) ? 255 : (unsigned char)(f * 255.f + 0.5f);
+	}
+
+	inline Pixel Pack(const Color& src)
+	{
+		Pixel p = { PackChannel(src.r), PackChannel(src.g), PackChannel(src.b), PackChannel(src.a) };
+		return p;
+	}
+
+	inline Color Unpack(const Pixel& src)
+	{
+		return Color(src.r, src.g, src.b, src.a) * (1.f / 255.f);
+	}
 };
 
 std::ostream & operator << (std::ostream &os, const Color &c);
\ No newline at end of file
@@ -0,0 +1,415 @@
+/* --------------------------------------------------------------------------
+
+composite.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Alpha compositing of one image onto another.
+
+-----------------------------------------------------------------------------*/
+
+#include "composite.h"
+#include "bufferview.h"
+#include "simd.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <vector>
+
+// Images of at least this many pixels are split in bands of rows over the pool.
+static const size_t PARALLEL_PIXELS = 1 << 16;
+static const int BAND_ROWS = 16;
+
+typedef void (*RowFn)(Color *, const Color *, size_t, float);
+typedef void (*AlphaFn)(Color *, size_t);
+
+Composite::Options::Options(Op o, float a, bool p)
+	: op(o)
+	, opacity(a)
+	, premultiplied(p)
+{
+
+}
+
+template <Composite::Op OP>
+static inline Color Apply(const Color& s, const Color& d)
+{
+	switch (OP)
+	{
+	case Composite::ADD:
+	{
+		Color o = s + d;
+		o.a = std::min(o.a, 1.f);
+		return o;
+	}
+	case Composite::MULTIPLY:	return s * (1.f - d.a) + d * (1.f - s.a) + s * d;
+	case Composite::SCREEN:		return s + d - s * d;
+	default:					return s + d * (1.f - s.a);
+	}
+}
+
+static inline Color Premultiply(const Color& c)
+{
+	return Color(c.r * c.a, c.g * c.a, c.b * c.a, c.a);
+}
+
+static inline Color Unpremultiply(const Color& c)
+{
+	if (c.a <= 0.f)
+		return Color(0.f, 0.f, 0.f, 0.f);
+
+	float k = 1.f / c.a;
+	return Color(c.r * k, c.g * k, c.b * k, c.a);
+}
+
+template <Composite::Op OP, bool PRE>
+static void RowScalar(Color *dst, const Color *src, size_t n, float opacity)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		Color s = src[i], d = dst[i];
+
+		if (!PRE)
+		{
+			s = Premultiply(s);
+			d = Premultiply(d);
+		}
+
+		Color o = Apply<OP>(s * opacity, d);
+		dst[i] = (PRE) ? o : Unpremultiply(o);
+	}
+}
+
+template <bool MUL>
+static void AlphaScalar(Color *c, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		c[i] = (MUL) ? Premultiply(c[i]) : Unpremultiply(c[i]);
+}
+
+#ifdef SIMD_X86
+
+// One pixel per register.  Masks pick the alpha lane: premultiplying is a
+// multiply by (a, a, a, 1), and unpremultiplying zeroes pixels without alpha.
+template <Composite::Op OP, bool PRE>
+SIMD_SSE2 static void RowSSE2(Color *dst, const Color *src, size_t n, float opacity)
+{
+	const __m128 one = _mm_set1_ps(1.f), zero = _mm_setzero_ps(), k = _mm_set1_ps(opacity);
+	const __m128 alpha = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+	const __m128 limit = _mm_set_ps(1.f, FLT_MAX, FLT_MAX, FLT_MAX);
+	const __m128 alpha_one = _mm_and_ps(alpha, one);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		__m128 s = _mm_loadu_ps((const float *)(src + i));
+		__m128 d = _mm_loadu_ps((const float *)(dst + i));
+		__m128 sa = _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3));
+		__m128 da = _mm_shuffle_ps(d, d, _MM_SHUFFLE(3, 3, 3, 3));
+
+		if (!PRE)
+		{
+			s = _mm_mul_ps(s, _mm_or_ps(_mm_andnot_ps(alpha, sa), alpha_one));
+			d = _mm_mul_ps(d, _mm_or_ps(_mm_andnot_ps(alpha, da), alpha_one));
+		}
+
+		s = _mm_mul_ps(s, k);
+		sa = _mm_mul_ps(sa, k);
+
+		__m128 o;
+
+		switch (OP)
+		{
+		case Composite::ADD:		o = _mm_min_ps(_mm_add_ps(s, d), limit); break;
+		case Composite::MULTIPLY:	o = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s, _mm_sub_ps(one, da)), _mm_mul_ps(d, _mm_sub_ps(one, sa))), _mm_mul_ps(s, d)); break;
+		case Composite::SCREEN:		o = _mm_sub_ps(_mm_add_ps(s, d), _mm_mul_ps(s, d)); break;
+		default:					o = _mm_add_ps(s, _mm_mul_ps(d, _mm_sub_ps(one, sa))); break;
+		}
+
+		if (!PRE)
+		{
+			__m128 oa = _mm_shuffle_ps(o, o, _MM_SHUFFLE(3, 3, 3, 3));
+			__m128 q = _mm_mul_ps(o, _mm_div_ps(one, oa));
+			o = _mm_and_ps(_mm_or_ps(_mm_andnot_ps(alpha, q), _mm_and_ps(alpha, o)), _mm_cmpgt_ps(oa, zero));
+		}
+
+		_mm_storeu_ps((float *)(dst + i), o);
+	}
+}
+
+// Same as SSE2, two pixels at a time.  Shuffles stay within 128 bit lanes.
+template <Composite::Op OP, bool PRE>
+SIMD_AVX2 static void RowAVX2(Color *dst, const Color *src, size_t n, float opacity)
+{
+	const __m256 one = _mm256_set1_ps(1.f), zero = _mm256_setzero_ps(), k = _mm256_set1_ps(opacity);
+	const __m256 alpha = _mm256_castsi256_ps(_mm256_set_epi32(-1, 0, 0, 0, -1, 0, 0, 0));
+	const __m256 limit = _mm256_set_ps(1.f, FLT_MAX, FLT_MAX, FLT_MAX, 1.f, FLT_MAX, FLT_MAX, FLT_MAX);
+	const __m256 alpha_one = _mm256_and_ps(alpha, one);
+
+	size_t i = 0;
+
+	for (; i + 2 <= n; i += 2)
+	{
+		__m256 s = _mm256_loadu_ps((const float *)(src + i));
+		__m256 d = _mm256_loadu_ps((const float *)(dst + i));
+		__m256 sa = _mm256_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3));
+		__m256 da = _mm256_shuffle_ps(d, d, _MM_SHUFFLE(3, 3, 3, 3));
+
+		if (!PRE)
+		{
+			s = _mm256_mul_ps(s, _mm256_or_ps(_mm256_andnot_ps(alpha, sa), alpha_one));
+			d = _mm256_mul_ps(d, _mm256_or_ps(_mm256_andnot_ps(alpha, da), alpha_one));
+		}
+
+		s = _mm256_mul_ps(s, k);
+		sa = _mm256_mul_ps(sa, k);
+
+		__m256 o;
+
+		switch (OP)
+		{
+		case Composite::ADD:		o = _mm256_min_ps(_mm256_add_ps(s, d), limit); break;
+		case Composite::MULTIPLY:	o = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(s, _mm256_sub_ps(one, da)), _mm256_mul_ps(d, _mm256_sub_ps(one, sa))), _mm256_mul_ps(s, d)); break;
+		case Composite::SCREEN:		o = _mm256_sub_ps(_mm256_add_ps(s, d), _mm256_mul_ps(s, d)); break;
+		default:					o = _mm256_add_ps(s, _mm256_mul_ps(d, _mm256_sub_ps(one, sa))); break;
+		}
+
+		if (!PRE)
+		{
+			__m256 oa = _mm256_shuffle_ps(o, o, _MM_SHUFFLE(3, 3, 3, 3));
+			__m256 q = _mm256_mul_ps(o, _mm256_div_ps(one, oa));
+			o = _mm256_and_ps(_mm256_or_ps(_mm256_andnot_ps(alpha, q), _mm256_and_ps(alpha, o)), _mm256_cmp_ps(oa, zero, _CMP_GT_OQ));
+		}
+
+		_mm256_storeu_ps((float *)(dst + i), o);
+	}
+
+	if (i < n)
+		RowSSE2<OP, PRE>(dst + i, src + i, n - i, opacity);
+}
+
+template <bool MUL>
+SIMD_SSE2 static void AlphaSSE2(Color *c, size_t n)
+{
+	const __m128 one = _mm_set1_ps(1.f), zero = _mm_setzero_ps();
+	const __m128 alpha = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+	const __m128 alpha_one = _mm_and_ps(alpha, one);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		__m128 p = _mm_loadu_ps((const float *)(c + i));
+		__m128 a = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+
+		if (MUL)
+			p = _mm_mul_ps(p, _mm_or_ps(_mm_andnot_ps(alpha, a), alpha_one));
+		else
+		{
+			__m128 q = _mm_mul_ps(p, _mm_div_ps(one, a));
+			p = _mm_and_ps(_mm_or_ps(_mm_andnot_ps(alpha, q), _mm_and_ps(alpha, p)), _mm_cmpgt_ps(a, zero));
+		}
+
+		_mm_storeu_ps((float *)(c + i), p);
+	}
+}
+
+template <bool MUL>
+SIMD_AVX2 static void AlphaAVX2(Color *c, size_t n)
+{
+	const __m256 one = _mm256_set1_ps(1.f), zero = _mm256_setzero_ps();
+	const __m256 alpha = _mm256_castsi256_ps(_mm256_set_epi32(-1, 0, 0, 0, -1, 0, 0, 0));
+	const __m256 alpha_one = _mm256_and_ps(alpha, one);
+
+	size_t i = 0;
+
+	for (; i + 2 <= n; i += 2)
+	{
+		__m256 p = _mm256_loadu_ps((const float *)(c + i));
+		__m256 a = _mm256_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+
+		if (MUL)
+			p = _mm256_mul_ps(p, _mm256_or_ps(_mm256_andnot_ps(alpha, a), alpha_one));
+		else
+		{
+			__m256 q = _mm256_mul_ps(p, _mm256_div_ps(one, a));
+			p = _mm256_and_ps(_mm256_or_ps(_mm256_andnot_ps(alpha, q), _mm256_and_ps(alpha, p)), _mm256_cmp_ps(a, zero, _CMP_GT_OQ));
+		}
+
+		_mm256_storeu_ps((float *)(c + i), p);
+	}
+
+	if (i < n)
+		AlphaSSE2<MUL>(c + i, n - i);
+}
+
+#endif
+
+template <Composite::Op OP, bool PRE>
+static RowFn PickRow()
+{
+#ifdef SIMD_X86
+	return SIMD::HasAVX2() ? &RowAVX2<OP, PRE> : &RowSSE2<OP, PRE>;
+#else
+	return &RowScalar<OP, PRE>;
+#endif
+}
+
+template <bool PRE>
+static RowFn PickRow(Composite::Op op)
+{
+	switch (op)
+	{
+	case Composite::ADD:		return PickRow<Composite::ADD, PRE>();
+	case Composite::MULTIPLY:	return PickRow<Composite::MULTIPLY, PRE>();
+	case Composite::SCREEN:		return PickRow<Composite::SCREEN, PRE>();
+	default:					return PickRow<Composite::OVER, PRE>();
+	}
+}
+
+static RowFn PickRow(const Composite::Options& opt)
+{
+	return (opt.premultiplied) ? PickRow<true>(opt.op) : PickRow<false>(opt.op);
+}
+
+void Composite::Row(Color *dst, const Color *src, size_t n, const Options& opt)
+{
+	PickRow(opt)(dst, src, n, opt.opacity);
+}
+
+template <bool MUL>
+static AlphaFn PickAlpha()
+{
+#ifdef SIMD_X86
+	return SIMD::HasAVX2() ? &AlphaAVX2<MUL> : &AlphaSSE2<MUL>;
+#else
+	return &AlphaScalar<MUL>;
+#endif
+}
+
+void Composite::Premultiply(Color *c, size_t n)
+{
+	static const AlphaFn fn = PickAlpha<true>();
+	fn(c, n);
+}
+
+void Composite::Unpremultiply(Color *c, size_t n)
+{
+	static const AlphaFn fn = PickAlpha<false>();
+	fn(c, n);
+}
+
+// Runs fn over the rows of v, through a float row for other formats.
+static void ConvertAlpha(const BufferView& v, AlphaFn fn)
+{
+	PixelFormat pf = v.GetFormat();
+	int w = v.GetSize().W, h = v.GetSize().H;
+
+	if (v.IsEmpty() || pf == A8 || !Format::Dispatch(pf, [](auto f) { return decltype(f)::HasAlpha; }))
+		return;
+
+	auto band = [&](int i) {
+		std::vector<Color> row((pf == RGBA32F) ? 0 : w);
+
+		for (int y = i * BAND_ROWS; y < std::min(h, (i + 1) * BAND_ROWS); y++)
+		{
+			if (pf == RGBA32F)
+			{
+				fn(v.Row<Format::RGBA32F>(y), w);
+				continue;
+			}
+
+			Format::ConvertRow(pf, v.Row(y), RGBA32F, row.data(), w);
+			fn(row.data(), w);
+			Format::ConvertRow(RGBA32F, row.data(), pf, v.Row(y), w);
+		}
+	};
+
+	int bands = (h + BAND_ROWS - 1) / BAND_ROWS;
+
+	if (bands > 1 && (size_t)w * h >= PARALLEL_PIXELS)
+		ThreadPool::Shared().For(bands, band);
+	else
+	{
+		for (int i = 0; i < bands; i++)
+			band(i);
+	}
+}
+
+void Composite::Premultiply(const BufferView& v)
+{
+	ConvertAlpha(v, &Composite::Premultiply);
+}
+
+void Composite::Unpremultiply(const BufferView& v)
+{
+	ConvertAlpha(v, &Composite::Unpremultiply);
+}
+
+void Composite::Blend(const BufferView& dst, const BufferView& src, const Options& opt)
+{
+	int w = std::min(dst.GetSize().W, src.GetSize().W);
+	int h = std::min(dst.GetSize().H, src.GetSize().H);
+
+	if (w <= 0 || h <= 0)
+		return;
+
+	PixelFormat d = dst.GetFormat(), s = src.GetFormat();
+	size_t src_row = w * Format::BytesPerPixel(s);
+
+	const unsigned char *dst_begin = dst.Row(0), *dst_end = dst.Row(h - 1) + w * Format::BytesPerPixel(d);
+	const unsigned char *src_begin = src.Row(0), *src_end = src.Row(h - 1) + src_row;
+
+	if (dst_begin < src_end && src_begin < dst_end)
+	{
+		// Blending a buffer onto itself: read from a copy.
+		std::vector<unsigned char> copy(src_row * h);
+
+		for (int y = 0; y < h; y++)
+			memcpy(&copy[y * src_row], src.Row(y), src_row);
+
+		Blend(dst, BufferView(copy.data(), Size(w, h), s), opt);
+		return;
+	}
+
+	RowFn fn = PickRow(opt);
+
+	auto band = [&](int i) {
+		std::vector<Color> sc((s == RGBA32F) ? 0 : w), dc((d == RGBA32F) ? 0 : w);
+
+		for (int y = i * BAND_ROWS; y < std::min(h, (i + 1) * BAND_ROWS); y++)
+		{
+			const Color *sp = src.Row<Format::RGBA32F>(y);
+			Color *dp = dst.Row<Format::RGBA32F>(y);
+
+			if (s != RGBA32F)
+			{
+				Format::ConvertRow(s, src.Row(y), RGBA32F, sc.data(), w);
+				sp = sc.data();
+			}
+
+			if (d != RGBA32F)
+			{
+				Format::ConvertRow(d, dst.Row(y), RGBA32F, dc.data(), w);
+				dp = dc.data();
+			}
+
+			fn(dp, sp, w, opt.opacity);
+
+			if (d != RGBA32F)
+				Format::ConvertRow(RGBA32F, dp, d, dst.Row(y), w);
+		}
+	};
+
+	int bands = (h + BAND_ROWS - 1) / BAND_ROWS;
+
+	if (bands > 1 && (size_t)w * h >= PARALLEL_PIXELS)
+		ThreadPool::Shared().For(bands, band);
+	else
+	{
+		for (int i = 0; i < bands; i++)
+			band(i);
+	}
+}
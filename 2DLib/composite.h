@@ -0,0 +1,62 @@
+/* --------------------------------------------------------------------------
+
+composite.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Alpha compositing of one image onto another.
+
+Every operator is written on premultiplied colors, where it is the same sum
+on all four channels, so a pixel is one SSE2 register (two with AVX2).
+Straight alpha colors are premultiplied on the way in and divided back on
+the way out, unless both sides are already premultiplied.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "color.h"
+
+class BufferView;
+
+namespace Composite
+{
+	// s and d are premultiplied source and destination.
+	enum Op
+	{
+		OVER,			// s + d * (1 - sa)
+		ADD,			// s + d, alpha clamped to 1
+		MULTIPLY,		// s * (1 - da) + d * (1 - sa) + s * d
+		SCREEN			// s + d - s * d
+	};
+
+	struct Options
+	{
+		Op op;
+		float opacity;			// Scales the whole source.
+		bool premultiplied;		// Both sides already hold premultiplied colors.
+
+		Options(Op o = OVER, float opacity = 1.f, bool premultiplied = false);
+	};
+
+	// Straight to premultiplied alpha and back, in place.  Colors without
+	// alpha unpremultiply to transparent black.
+	void Premultiply(Color *c, size_t n);
+	void Unpremultiply(Color *c, size_t n);
+
+	// The same over a view of any format.  Formats without color or without
+	// alpha are left as they are.
+	void Premultiply(const BufferView& v);
+	void Unpremultiply(const BufferView& v);
+
+	// Composites n source colors onto dst, in place.
+	void Row(Color *dst, const Color *src, size_t n, const Options& opt);
+
+	// Composites src onto dst from the top left corner, as far as both go,
+	// converting the formats.  Large images are split over the shared pool.
+	void Blend(const BufferView& dst, const BufferView& src, const Options& opt);
+};
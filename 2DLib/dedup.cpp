@@ -0,0 +1,67 @@
+/* --------------------------------------------------------------------------
+
+dedup.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Finding regions with identical pixels.
+
+-----------------------------------------------------------------------------*/
+
+#include "dedup.h"
+#include <cstring>
+
+// Mixed into the hash of premultiplied regions.
+static const unsigned long long PREMULTIPLIED_KEY = 0x9E3779B97F4A7C15ULL;
+
+bool DedupIndex::Same(const Entry &a, const Entry &b) const
+{
+	if (a.buffer->GetFormat() != b.buffer->GetFormat() || a.buffer->IsPremultiplied() != b.buffer->IsPremultiplied() || a.rect.GetWidth() != b.rect.GetWidth() || a.rect.GetHeight() != b.rect.GetHeight())
+		return false;
+
+	size_t bpp = Format::BytesPerPixel(a.buffer->GetFormat());
+	size_t row = a.rect.GetWidth() * bpp;
+	int wa = a.buffer->GetSize().W, wb = b.buffer->GetSize().W;
+
+	for (int y = 0; y < a.rect.GetHeight(); y++)
+	{
+		const unsigned char *pa = a.buffer->GetBits() + ((size_t)(a.rect.top + y) * wa + a.rect.left) * bpp;
+		const unsigned char *pb = b.buffer->GetBits() + ((size_t)(b.rect.top + y) * wb + b.rect.left) * bpp;
+
+		if (memcmp(pa, pb, row) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+size_t DedupIndex::Add(const Buffer &b, const Rect &r)
+{
+	return Add(b, r, b.Hash(r));
+}
+
+size_t DedupIndex::Add(const Buffer &b, const Rect &r, unsigned long long hash)
+{
+	Entry e = { &b, r, entries.size() };
+	// The same bytes are different colors in the other alpha mode.
+	std::vector<size_t> &bucket = buckets[(b.IsPremultiplied()) ? hash ^ PREMULTIPLIED_KEY : hash];
+
+	for (size_t i : bucket)
+	{
+		if (Same(entries[i], e))
+		{
+			e.canonical = i;
+			break;
+		}
+	}
+
+	if (e.canonical == entries.size())
+		bucket.push_back(e.canonical);
+
+	entries.push_back(e);
+	return e.canonical;
+}
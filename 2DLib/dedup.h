@@ -0,0 +1,50 @@
+/* --------------------------------------------------------------------------
+
+dedup.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Finding regions with identical pixels, e.g. repeated animation frames.
+
+Regions are bucketed by their content hash, and a hash match is confirmed
+by comparing the rows, so different regions are never merged.  The index
+only points at the buffers: they must outlive it and not change.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include "buffer.h"
+
+class DedupIndex
+{
+	struct Entry
+	{
+		const Buffer *buffer;
+		Rect rect;
+		size_t canonical;
+	};
+
+	std::vector<Entry> entries;
+	std::unordered_map<unsigned long long, std::vector<size_t>> buckets;
+
+	bool Same(const Entry &a, const Entry &b) const;
+
+public:
+
+	// Adds r of b, whose content hash is given (see Buffer::Hash()) or worked
+	// out.  Returns the index of the first entry with the same pixels, its
+	// own index if there is none.
+	size_t Add(const Buffer &b, const Rect &r);
+	size_t Add(const Buffer &b, const Rect &r, unsigned long long hash);
+
+	size_t GetCount() const { return entries.size(); }
+	size_t GetCanonical(size_t i) const { return entries[i].canonical; }
+	bool IsDuplicate(size_t i) const { return entries[i].canonical != i; }
+};
@@ -0,0 +1,200 @@
+/* --------------------------------------------------------------------------
+
+hash.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+64 bit content hashes of pixels.
+
+-----------------------------------------------------------------------------*/
+
+#include "hash.h"
+#include <algorithm>
+#include <cstring>
+
+static const unsigned long long PRIME1 = 11400714785074694791ULL;
+static const unsigned long long PRIME2 = 14029467366897019727ULL;
+static const unsigned long long PRIME3 = 1609587929392839161ULL;
+static const unsigned long long PRIME4 = 9650029242287828579ULL;
+static const unsigned long long PRIME5 = 2870177450012600261ULL;
+
+static inline unsigned long long Rotate(unsigned long long x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads, whatever the machine.
+static inline unsigned long long Read64(const unsigned char *p)
+{
+	unsigned long long v = 0;
+
+	for (int i = 7; i >= 0; i--)
+		v = (v << 8) | p[i];
+
+	return v;
+}
+
+static inline unsigned long long Read32(const unsigned char *p)
+{
+	return (unsigned long long)p[0] | ((unsigned long long)p[1] << 8) | ((unsigned long long)p[2] << 16) | ((unsigned long long)p[3] << 24);
+}
+
+static inline unsigned long long Round(unsigned long long acc, unsigned long long input)
+{
+	acc += input * PRIME2;
+	acc = Rotate(acc, 31);
+	return acc * PRIME1;
+}
+
+static inline unsigned long long Merge(unsigned long long acc, unsigned long long v)
+{
+	acc ^= Round(0, v);
+	return acc * PRIME1 + PRIME4;
+}
+
+Hash::XXH64::XXH64(unsigned long long s)
+{
+	Reset(s);
+}
+
+void Hash::XXH64::Reset(unsigned long long s)
+{
+	seed = s;
+	total = 0;
+	used = 0;
+
+	v[0] = s + PRIME1 + PRIME2;
+	v[1] = s + PRIME2;
+	v[2] = s;
+	v[3] = s - PRIME1;
+}
+
+void Hash::XXH64::Update(const void *data, size_t n)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	total += n;
+
+	// Finish a stripe started by the last call.
+	if (used)
+	{
+		size_t k = std::min(n, 32 - used);
+		memcpy(pending + used, p, k);
+		used += k;
+		p += k;
+		n -= k;
+
+		if (used < 32)
+			return;
+
+		for (int i = 0; i < 4; i++)
+			v[i] = Round(v[i], Read64(pending + i * 8));
+
+		used = 0;
+	}
+
+	// Four independent lanes the CPU runs side by side.
+	unsigned long long v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+
+	for (; n >= 32; p += 32, n -= 32)
+	{
+		v0 = Round(v0, Read64(p));
+		v1 = Round(v1, Read64(p + 8));
+		v2 = Round(v2, Read64(p + 16));
+		v3 = Round(v3, Read64(p + 24));
+	}
+
+	v[0] = v0;
+	v[1] = v1;
+	v[2] = v2;
+	v[3] = v3;
+
+	memcpy(pending, p, n);
+	used = n;
+}
+
+unsigned long long Hash::XXH64::Digest() const
+{
+	unsigned long long h;
+
+	if (total >= 32)
+	{
+		h = Rotate(v[0], 1) + Rotate(v[1], 7) + Rotate(v[2], 12) + Rotate(v[3], 18);
+
+		for (int i = 0; i < 4; i++)
+			h = Merge(h, v[i]);
+	}
+	else
+		h = seed + PRIME5;
+
+	h += total;
+
+	const unsigned char *p = pending;
+	size_t n = used;
+
+	for (; n >= 8; p += 8, n -= 8)
+		h = Rotate(h ^ Round(0, Read64(p)), 27) * PRIME1 + PRIME4;
+
+	if (n >= 4)
+	{
+		h = Rotate(h ^ (Read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+		p += 4;
+		n -= 4;
+	}
+
+	for (; n; p++, n--)
+		h = Rotate(h ^ (*p * PRIME5), 11) * PRIME1;
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+unsigned long long Hash::Bytes(const void *data, size_t n, unsigned long long seed)
+{
+	XXH64 h(seed);
+	h.Update(data, n);
+	return h.Digest();
+}
+
+unsigned long long Hash::Region(const unsigned char *bits, size_t stride, PixelFormat pf, const Rect &r)
+{
+	XXH64 h;
+
+	int w = r.right - r.left + 1, rows = r.bottom - r.top + 1;
+	unsigned char header[12];
+
+	for (int i = 0; i < 4; i++)
+	{
+		header[i] = (unsigned char)((unsigned int)pf >> (8 * i));
+		header[4 + i] = (unsigned char)((unsigned int)w >> (8 * i));
+		header[8 + i] = (unsigned char)((unsigned int)rows >> (8 * i));
+	}
+
+	h.Update(header, sizeof(header));
+
+	if (w <= 0 || rows <= 0)
+		return h.Digest();
+
+	size_t bpp = Format::BytesPerPixel(pf);
+	size_t row = (size_t)w * bpp;
+
+	// Whole rows without gaps are one piece.
+	if (r.left == 0 && row == stride)
+	{
+		h.Update(bits + (size_t)r.top * row, row * rows);
+		return h.Digest();
+	}
+
+	for (int y = r.top; y <= r.bottom; y++)
+		h.Update(bits + (size_t)y * stride + r.left * bpp, row);
+
+	return h.Digest();
+}
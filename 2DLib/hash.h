@@ -0,0 +1,51 @@
+/* --------------------------------------------------------------------------
+
+hash.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+64 bit content hashes of pixels, to find identical images and regions.
+
+The hash is XXH64, fed with the format, the size and then the rows, so a
+region hashes the same wherever it sits in whichever buffer as long as its
+pixels are stored the same way.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <cstddef>
+#include "pixelformat.h"
+#include "rect.h"
+
+namespace Hash
+{
+	// XXH64 over data given in pieces.  The result doesn't depend on how the
+	// data was split.
+	class XXH64
+	{
+		unsigned long long v[4];
+		unsigned long long seed;
+		unsigned long long total;
+		unsigned char pending[32];
+		size_t used;
+
+	public:
+
+		explicit XXH64(unsigned long long seed = 0);
+
+		void Reset(unsigned long long seed = 0);
+		void Update(const void *data, size_t n);
+		unsigned long long Digest() const;
+	};
+
+	unsigned long long Bytes(const void *data, size_t n, unsigned long long seed = 0);
+
+	// Hash of the pixels in r, which must be inside the image of format pf
+	// with rows stride bytes apart.
+	unsigned long long Region(const unsigned char *bits, size_t stride, PixelFormat pf, const Rect &r);
+};
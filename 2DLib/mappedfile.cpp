@@ -0,0 +1,138 @@
+/* --------------------------------------------------------------------------
+
+mappedfile.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+A whole file mapped in memory, copy-on-write.
+
+-----------------------------------------------------------------------------*/
+
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+	: data(nullptr)
+	, length(0)
+#ifdef _WIN32
+	, file(INVALID_HANDLE_VALUE)
+	, mapping(nullptr)
+#endif
+{
+
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string &filename)
+{
+	Close();
+
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER li;
+
+	if (!GetFileSizeEx(file, &li) || li.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	length = (size_t)li.QuadPart;
+
+	// PAGE_WRITECOPY / FILE_MAP_COPY give copy-on-write pages.
+	mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+	if (mapping)
+		data = (unsigned char *)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+
+	if (!data)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data)
+		UnmapViewOfFile(data);
+
+	if (mapping)
+		CloseHandle(mapping);
+
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+
+	data = nullptr;
+	length = 0;
+	mapping = nullptr;
+	file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool MappedFile::Open(const std::string &filename)
+{
+	Close();
+
+	int fd = open(filename.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	// MAP_PRIVATE with write access gives copy-on-write pages.  The mapping
+	// keeps the file alive, the descriptor isn't needed anymore.
+	void *p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (p == MAP_FAILED)
+		return false;
+
+	data = (unsigned char *)p;
+	length = (size_t)st.st_size;
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (data)
+		munmap(data, length);
+
+	data = nullptr;
+	length = 0;
+}
+
+#endif
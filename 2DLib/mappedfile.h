@@ -0,0 +1,51 @@
+/* --------------------------------------------------------------------------
+
+mappedfile.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+A whole file mapped in memory, copy-on-write: pages are read from disk when
+first touched, and writing to them makes a private copy that never reaches
+the file.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+
+class MappedFile
+{
+	unsigned char *data;
+	size_t length;
+
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#endif
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator = (const MappedFile&);
+
+public:
+
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const std::string &filename);
+	void Close();
+
+	inline unsigned char *GetData() const
+	{
+		return data;
+	}
+
+	inline size_t GetSize() const
+	{
+		return length;
+	}
+};
@@ -0,0 +1,78 @@
+/* --------------------------------------------------------------------------
+
+mask.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Which pixels count as content when trimming or indexing a buffer: anything
+but a given color, or anything with more than a given alpha.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "pixelformat.h"
+
+struct Mask
+{
+	enum Mode { EXCEPT_COLOR, ALPHA_ABOVE };
+
+	Mode mode;
+	Color color;	// EXCEPT_COLOR: pixels that don't read as this color are content.
+	float alpha;	// ALPHA_ABOVE: pixels with more alpha than this are content.
+
+	static Mask Except(const Color &c) { Mask m = { EXCEPT_COLOR, c, 0.f }; return m; }
+	static Mask AlphaAbove(float a) { Mask m = { ALPHA_ABOVE, Color(0.f), a }; return m; }
+
+	bool operator == (const Mask& m) const
+	{
+		return mode == m.mode && ((mode == EXCEPT_COLOR) ? color == m.color : alpha == m.alpha);
+	}
+
+	bool operator != (const Mask& m) const { return !(*this == m); }
+};
+
+namespace Format
+{
+	// The test of a Mask for pixels of format F, set up once per operation.
+	// Colors are compared as they read back in F, like Scan() does, and 8 bit
+	// alphas against the largest value not above the threshold.
+	template <class F>
+	struct MaskTest
+	{
+		Mask::Mode mode;
+		typename F::Type stored;		// EXCEPT_COLOR, as stored in F.
+		typename F::Work target;		// EXCEPT_COLOR, as read back.
+		float alpha;
+		int alpha8;						// -1 when every alpha is above.
+
+		MaskTest(const Mask &m)
+			: mode(m.mode)
+			, stored(Store<F>(m.color))
+			, target(F::ToWork(stored))
+			, alpha(m.alpha)
+			, alpha8(-1)
+		{
+			for (int a = 0; a < 256; a++)
+			{
+				if ((float)a * (1.f / 255.f) <= m.alpha)
+					alpha8 = a;
+			}
+		}
+
+		inline bool Above(const Color &w) const { return w.a > alpha; }
+		inline bool Above(const Pixel &w) const { return (int)w.a > alpha8; }
+
+		inline bool operator () (const typename F::Type &t) const
+		{
+			if (mode == Mask::EXCEPT_COLOR)
+				return !(F::ToWork(t) == target);
+
+			return Above(F::ToWork(t));
+		}
+	};
+};
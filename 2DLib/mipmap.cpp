@@ -0,0 +1,286 @@
+/* --------------------------------------------------------------------------
+
+mipmap.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Mipmap chains.
+
+-----------------------------------------------------------------------------*/
+
+#include "mipmap.h"
+#include "bufferview.h"
+#include "composite.h"
+#include "resample.h"
+#include "simd.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+// Rows per band when halving and storing levels.
+static const int BAND_ROWS = 16;
+
+static float SRGBToLinear(float v)
+{
+	return (v <= 0.04045f) ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+static float LinearToSRGB(float v)
+{
+	return (v <= 0.0031308f) ? v * 12.92f : 1.055f * std::pow(v, 1.f / 2.4f) - 0.055f;
+}
+
+// Only 8 bit colors are decoded, so a table of their 256 values does.  Once
+// unpremultiplied they are no longer exact steps, and can be over 1 where
+// color was above alpha: they are rounded and clamped to the nearest step.
+static void DecodeSRGB(Color *c, int n)
+{
+	static const std::vector<float> table = [] {
+		std::vector<float> t(256);
+
+		for (int i = 0; i < 256; i++)
+			t[i] = SRGBToLinear(i / 255.f);
+
+		return t;
+	}();
+
+	const float *t = table.data();
+
+	for (int i = 0; i < n; i++)
+	{
+		c[i].r = t[RGBA::PackChannel(c[i].r)];
+		c[i].g = t[RGBA::PackChannel(c[i].g)];
+		c[i].b = t[RGBA::PackChannel(c[i].b)];
+	}
+}
+
+// Encoding only goes back to 8 bits: interpolating a table of 4096 steps
+// is well within half a step of 1/255, and much faster than pow().
+static const int ENCODE_STEPS = 4096;
+
+static float EncodeChannel(const float *t, float v)
+{
+	v = std::min(std::max(v, 0.f), 1.f) * ENCODE_STEPS;
+
+	int i = std::min((int)v, ENCODE_STEPS - 1);
+	return t[i] + (t[i + 1] - t[i]) * (v - i);
+}
+
+static void EncodeSRGB(Color *c, int n)
+{
+	static const std::vector<float> table = [] {
+		std::vector<float> t(ENCODE_STEPS + 1);
+
+		for (int i = 0; i <= ENCODE_STEPS; i++)
+			t[i] = LinearToSRGB((float)i / ENCODE_STEPS);
+
+		return t;
+	}();
+
+	const float *t = table.data();
+
+	for (int i = 0; i < n; i++)
+	{
+		c[i].r = EncodeChannel(t, c[i].r);
+		c[i].g = EncodeChannel(t, c[i].g);
+		c[i].b = EncodeChannel(t, c[i].b);
+	}
+}
+
+#ifndef SIMD_X86
+
+// out[i] is the average of the 2x2 pixels at 2i on rows r0 and r1.
+static void HalveRowScalar(Color *out, const Color *r0, const Color *r1, int n)
+{
+	for (int i = 0; i < n; i++)
+		out[i] = (r0[2 * i] + r0[2 * i + 1] + r1[2 * i] + r1[2 * i + 1]) * 0.25f;
+}
+
+#endif
+
+#ifdef SIMD_X86
+
+SIMD_SSE2 static void HalveRowSSE2(Color *out, const Color *r0, const Color *r1, int n)
+{
+	const float *a = (const float *)r0, *b = (const float *)r1;
+	const __m128 quarter = _mm_set1_ps(0.25f);
+
+	for (int i = 0; i < n; i++, a += 8, b += 8)
+	{
+		__m128 s = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(a), _mm_loadu_ps(a + 4)), _mm_add_ps(_mm_loadu_ps(b), _mm_loadu_ps(b + 4)));
+		_mm_storeu_ps((float *)(out + i), _mm_mul_ps(s, quarter));
+	}
+}
+
+#endif
+
+static void HalveRow(Color *out, const Color *r0, const Color *r1, int n)
+{
+#ifdef SIMD_X86
+	HalveRowSSE2(out, r0, r1, n);
+#else
+	HalveRowScalar(out, r0, r1, n);
+#endif
+}
+
+// What alpha must be multiplied by for share of the pixels of level to have
+// at least ref: ref over the alpha of the pixel ranked at that share.
+static float CoverageScale(const std::vector<Color> &level, float ref, double share)
+{
+	size_t pass = (size_t)(share * level.size() + 0.5);
+
+	if (pass == 0)
+		return 1.f;
+
+	std::vector<float> alpha(level.size());
+
+	for (size_t i = 0; i < level.size(); i++)
+		alpha[i] = level[i].a;
+
+	std::nth_element(alpha.begin(), alpha.begin() + (pass - 1), alpha.end(), std::greater<float>());
+
+	return (alpha[pass - 1] > 0.f) ? ref / alpha[pass - 1] : 1.f;
+}
+
+Mipmap::Chain::Chain()
+	: format(RGBA8)
+	, premultiplied(false)
+{
+
+}
+
+BufferView Mipmap::Chain::GetLevel(int level) const
+{
+	return BufferView(const_cast<unsigned char *>(&bits[offsets[level]]), sizes[level], format);
+}
+
+Mipmap::Chain Mipmap::Build(const BufferView& v, bool premultiplied, const Options& opt)
+{
+	Chain chain;
+	chain.format = v.GetFormat();
+	chain.premultiplied = premultiplied;
+
+	if (v.IsEmpty())
+		return chain;
+
+	// Every level in one allocation.
+	size_t bpp = Format::BytesPerPixel(chain.format), total = 0;
+
+	for (Size s = v.GetSize(); ; s = Size(std::max(1, s.W / 2), std::max(1, s.H / 2)))
+	{
+		chain.sizes.push_back(s);
+		chain.offsets.push_back(total);
+		total += (size_t)s.W * s.H * bpp;
+
+		if ((s.W == 1 && s.H == 1) || (opt.levels > 0 && chain.GetLevels() >= opt.levels))
+			break;
+	}
+
+	chain.bits.resize(total);
+	chain.GetLevel(0).CopyFrom(v);
+
+	if (chain.GetLevels() == 1)
+		return chain;
+
+	bool has_alpha = Format::Dispatch(chain.format, [](auto f) { return decltype(f)::HasAlpha; });
+	bool linear = opt.srgb && !Format::Dispatch(chain.format, [](auto f) { return decltype(f)::IsFloat; });
+	bool test = has_alpha && opt.alpha_test > 0.f;
+
+	// Levels are filtered as linear premultiplied floats.
+	auto to_work = [&](Color *row, int n) {
+		if (linear)
+		{
+			if (has_alpha && premultiplied)
+				Composite::Unpremultiply(row, n);
+
+			DecodeSRGB(row, n);
+		}
+
+		if (has_alpha && (linear || !premultiplied))
+			Composite::Premultiply(row, n);
+	};
+
+	auto from_work = [&](Color *row, int n, float scale) {
+		bool straighten = has_alpha && (linear || !premultiplied || scale != 1.f);
+
+		if (straighten)
+			Composite::Unpremultiply(row, n);
+
+		if (linear)
+			EncodeSRGB(row, n);
+
+		if (scale != 1.f)
+		{
+			for (int i = 0; i < n; i++)
+				row[i].a = std::min(row[i].a * scale, 1.f);
+		}
+
+		if (straighten && premultiplied)
+			Composite::Premultiply(row, n);
+	};
+
+	Size s = chain.sizes[0];
+	std::vector<Color> cur((size_t)s.W * s.H), next;
+
+	ThreadPool::Shared().For((s.H + BAND_ROWS - 1) / BAND_ROWS, [&](int b) {
+		for (int y = b * BAND_ROWS; y < std::min(s.H, (b + 1) * BAND_ROWS); y++)
+		{
+			Color *row = &cur[(size_t)y * s.W];
+
+			Format::ConvertRow(chain.format, v.Row(y), RGBA32F, row, s.W);
+			to_work(row, s.W);
+		}
+	});
+
+	// Share of the first level passing the alpha test.
+	double share = 0.0;
+
+	if (test)
+	{
+		size_t pass = std::count_if(cur.begin(), cur.end(), [&](const Color& c) { return c.a >= opt.alpha_test; });
+		share = (double)pass / cur.size();
+	}
+
+	for (int l = 1; l < chain.GetLevels(); l++)
+	{
+		Size ps = chain.sizes[l - 1];
+		s = chain.sizes[l];
+		next.resize((size_t)s.W * s.H);
+
+		if (opt.filter == BOX && ps.W == 2 * s.W && ps.H == 2 * s.H)
+		{
+			ThreadPool::Shared().For((s.H + BAND_ROWS - 1) / BAND_ROWS, [&](int b) {
+				for (int y = b * BAND_ROWS; y < std::min(s.H, (b + 1) * BAND_ROWS); y++)
+					HalveRow(&next[(size_t)y * s.W], &cur[(size_t)(2 * y) * ps.W], &cur[(size_t)(2 * y + 1) * ps.W], s.W);
+			});
+		}
+		else
+		{
+			Resample::Options ro((opt.filter == KAISER) ? Resample::KAISER : Resample::BOX, true);
+			Resample::Resize(BufferView(next.data(), s, RGBA32F), BufferView(cur.data(), ps, RGBA32F), ro);
+		}
+
+		float scale = (test) ? CoverageScale(next, opt.alpha_test, share) : 1.f;
+		BufferView level = chain.GetLevel(l);
+
+		ThreadPool::Shared().For((s.H + BAND_ROWS - 1) / BAND_ROWS, [&](int b) {
+			std::vector<Color> row(s.W);
+
+			for (int y = b * BAND_ROWS; y < std::min(s.H, (b + 1) * BAND_ROWS); y++)
+			{
+				std::copy(&next[(size_t)y * s.W], &next[(size_t)y * s.W] + s.W, row.begin());
+				from_work(row.data(), s.W, scale);
+				Format::ConvertRow(RGBA32F, row.data(), chain.format, level.Row(y), s.W);
+			}
+		});
+
+		cur.swap(next);
+	}
+
+	return chain;
+}
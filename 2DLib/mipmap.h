@@ -0,0 +1,83 @@
+/* --------------------------------------------------------------------------
+
+mipmap.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Mipmap chains: an image and its successive halvings down to 1x1, built in
+one call and kept in a single allocation, largest level first, so the whole
+chain can be written or uploaded as it is.
+
+Each level is made from the one before it, kept in float between levels so
+rounding doesn't pile up.  8 bit colors are taken as sRGB and filtered in
+linear light, and alpha is premultiplied while filtering.  Even sizes are
+halved with a 2x2 box a pixel per SSE2 register; odd sizes and the Kaiser
+filter go through Resample.
+
+Cutout sprites drawn with an alpha test thin out as they get smaller.  With
+an alpha_test reference, the alpha of each level is scaled so the same share
+of pixels passes the test as on the first level.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include "pixelformat.h"
+#include "rect.h"
+
+class BufferView;
+
+namespace Mipmap
+{
+	enum Filter
+	{
+		BOX,		// Average of 2x2 pixels.  Fast, a little soft.
+		KAISER		// Kaiser windowed sinc.  Sharper, for textures seen up close.
+	};
+
+	struct Options
+	{
+		Filter filter;
+		bool srgb;			// 8 bit colors are sRGB and are filtered in linear light.  Float ones are linear.
+		float alpha_test;	// Keep the share of pixels with at least this alpha on every level.  0 not to.
+		int levels;			// Most levels to make, the first one included.  0 for all of them.
+
+		Options(Filter f = BOX, bool s = true, float a = 0.f, int l = 0) : filter(f), srgb(s), alpha_test(a), levels(l) { }
+	};
+
+	class Chain
+	{
+		PixelFormat format;
+		bool premultiplied;
+		std::vector<unsigned char> bits;	// Every level, one after the other, rows without gaps.
+		std::vector<Size> sizes;
+		std::vector<size_t> offsets;		// Of each level in bits.
+
+		friend Chain Build(const BufferView& v, bool premultiplied, const Options& opt);
+
+	public:
+
+		Chain();
+
+		inline int GetLevels() const { return (int)sizes.size(); }
+		inline Size GetSize(int level) const { return sizes[level]; }
+		inline PixelFormat GetFormat() const { return format; }
+		inline bool IsPremultiplied() const { return premultiplied; }
+
+		// The whole chain, for writing or uploading it in one go.
+		inline const unsigned char *GetBits() const { return bits.data(); }
+		inline size_t GetByteSize() const { return bits.size(); }
+		inline size_t GetOffset(int level) const { return offsets[level]; }
+
+		// One level.  Only read from it when the chain is const.
+		BufferView GetLevel(int level) const;
+	};
+
+	// The chain of v, in v's format and alpha mode.
+	Chain Build(const BufferView& v, bool premultiplied = false, const Options& opt = Options());
+};
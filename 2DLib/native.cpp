@@ -0,0 +1,232 @@
+/* --------------------------------------------------------------------------
+
+native.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+The library's own image container (.2dl).
+
+-----------------------------------------------------------------------------*/
+
+#include "native.h"
+#include <cstring>
+#include <zlib.h>
+
+static const unsigned char MAGIC[4] = { '2', 'D', 'L', 0x1A };
+static const unsigned short VERSION = 1;
+
+static void Put16(unsigned char *p, unsigned int v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+}
+
+static void Put32(unsigned char *p, unsigned int v)
+{
+	Put16(p, v & 0xFFFF);
+	Put16(p + 2, v >> 16);
+}
+
+static void Put64(unsigned char *p, unsigned long long v)
+{
+	Put32(p, (unsigned int)(v & 0xFFFFFFFF));
+	Put32(p + 4, (unsigned int)(v >> 32));
+}
+
+static unsigned int Get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int Get32(const unsigned char *p)
+{
+	return Get16(p) | (Get16(p + 2) << 16);
+}
+
+static unsigned long long Get64(const unsigned char *p)
+{
+	return Get32(p) | ((unsigned long long)Get32(p + 4) << 32);
+}
+
+Native::Header::Header()
+	: format(RGBA8)
+	, width(0)
+	, height(0)
+	, compression(NONE)
+	, flags(0)
+	, tile_w(0)
+	, tile_h(0)
+	, data_offset(HEADER_SIZE)
+	, index_offset(0)
+{
+
+}
+
+// Layout:  0 magic, 4 version, 6 format, 8 width, 12 height, 16 compression,
+// 18 flags, 20 tile_w, 24 tile_h, 28 reserved, 32 data_offset, 40 index_offset.
+
+bool Native::ReadHeader(FILE *fp, Header &h)
+{
+	unsigned char header[HEADER_SIZE];
+
+	if (fread(header, HEADER_SIZE, 1, fp) != 1 || memcmp(header, MAGIC, 4) != 0 || Get16(header + 4) != VERSION)
+		return false;
+
+	unsigned int format = Get16(header + 6);
+
+	if (format > RGBA16F)
+		return false;
+
+	unsigned int width = Get32(header + 8), height = Get32(header + 12);
+	unsigned int tile_w = Get32(header + 20), tile_h = Get32(header + 24);
+
+	if (width == 0 || width > MAX_SIDE || height == 0 || height > MAX_SIDE)
+		return false;
+
+	h.format = (PixelFormat)format;
+	h.width = (int)width;
+	h.height = (int)height;
+	h.compression = (Compression)Get16(header + 16);
+	h.flags = (unsigned short)Get16(header + 18);
+	h.tile_w = (tile_w <= MAX_SIDE) ? (int)tile_w : 0;
+	h.tile_h = (tile_h <= MAX_SIDE) ? (int)tile_h : 0;
+	h.data_offset = Get64(header + 32);
+	h.index_offset = Get64(header + 40);
+
+	if (h.compression != NONE && h.compression != DEFLATE)
+		return false;
+
+	if (h.data_offset < HEADER_SIZE || h.data_offset % DATA_ALIGN != 0)
+		return false;
+
+	// At most 2^36 bytes, which a 32 bit size_t may not hold.
+	unsigned long long bytes = (unsigned long long)width * height * Format::BytesPerPixel(h.format);
+	unsigned long long file = FileSize(fp);
+
+	if (bytes > (size_t)-1)
+		return false;
+
+	if (h.compression == NONE)
+		return h.data_offset <= file && bytes <= file - h.data_offset;
+
+	if (h.tile_w <= 0 || h.tile_h <= 0)
+		return false;
+
+	unsigned long long index = (unsigned long long)h.TilesX() * h.TilesY() * 16;
+
+	return h.index_offset <= file && index <= file - h.index_offset && bytes / MAX_DEFLATE_RATIO <= file;
+}
+
+bool Native::WriteHeader(FILE *fp, const Header &h)
+{
+	unsigned char header[HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+
+	memcpy(header, MAGIC, 4);
+	Put16(header + 4, VERSION);
+	Put16(header + 6, h.format);
+	Put32(header + 8, h.width);
+	Put32(header + 12, h.height);
+	Put16(header + 16, h.compression);
+	Put16(header + 18, h.flags);
+	Put32(header + 20, h.tile_w);
+	Put32(header + 24, h.tile_h);
+	Put64(header + 32, h.data_offset);
+	Put64(header + 40, h.index_offset);
+
+	return (fwrite(header, HEADER_SIZE, 1, fp) == 1);
+}
+
+bool Native::ReadIndex(FILE *fp, const Header &h, std::vector<Tile> &index)
+{
+	// ReadHeader checked the index is within the file.
+	size_t n = (size_t)h.TilesX() * h.TilesY();
+	std::vector<unsigned char> raw(n * 16);
+
+	if (!Seek(fp, h.index_offset) || (n && fread(raw.data(), raw.size(), 1, fp) != 1))
+		return false;
+
+	unsigned long long file = FileSize(fp);
+	index.resize(n);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		index[i].offset = Get64(&raw[i * 16]);
+		index[i].length = Get64(&raw[i * 16 + 8]);
+
+		if (index[i].offset > file || index[i].length > file - index[i].offset)
+			return false;
+	}
+
+	return true;
+}
+
+bool Native::WriteIndex(FILE *fp, const std::vector<Tile> &index)
+{
+	std::vector<unsigned char> raw(index.size() * 16);
+
+	for (size_t i = 0; i < index.size(); i++)
+	{
+		Put64(&raw[i * 16], index[i].offset);
+		Put64(&raw[i * 16 + 8], index[i].length);
+	}
+
+	return (raw.empty() || fwrite(raw.data(), raw.size(), 1, fp) == 1);
+}
+
+bool Native::CompressTile(const unsigned char *src, size_t size, std::vector<unsigned char> &out)
+{
+	uLongf length = compressBound((uLong)size);
+	out.resize(length);
+
+	// Fast level: this is a cache between pipeline stages, not an archive.
+	if (compress2(out.data(), &length, src, (uLong)size, Z_BEST_SPEED) != Z_OK)
+		return false;
+
+	out.resize(length);
+	return true;
+}
+
+bool Native::DecompressTile(const unsigned char *src, size_t length, unsigned char *dst, size_t size)
+{
+	uLongf n = (uLongf)size;
+	return (uncompress(dst, &n, src, (uLong)length) == Z_OK && n == size);
+}
+
+bool Native::Seek(FILE *fp, unsigned long long offset)
+{
+#ifdef _WIN32
+	return _fseeki64(fp, (long long)offset, SEEK_SET) == 0;
+#else
+	return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+unsigned long long Native::Tell(FILE *fp)
+{
+#ifdef _WIN32
+	return (unsigned long long)_ftelli64(fp);
+#else
+	return (unsigned long long)ftello(fp);
+#endif
+}
+
+unsigned long long Native::FileSize(FILE *fp)
+{
+	unsigned long long pos = Tell(fp);
+
+#ifdef _WIN32
+	_fseeki64(fp, 0, SEEK_END);
+#else
+	fseeko(fp, 0, SEEK_END);
+#endif
+
+	unsigned long long size = Tell(fp);
+	Seek(fp, pos);
+
+	return size;
+}
@@ -0,0 +1,98 @@
+/* --------------------------------------------------------------------------
+
+native.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+The library's own image container (.2dl), made to be loaded fast.
+
+A 64 byte header, then the pixels in a Buffer's own layout:
+- uncompressed: all rows at data_offset (64 byte aligned), so the file can
+  be mapped and used in place;
+- compressed: tiles of tile_w x tile_h pixels, each deflated on its own,
+  with an index of (offset, length) at index_offset.  Tiles can be decoded
+  in parallel, and only the ones a Rect needs have to be.
+
+Header and index numbers are little-endian.  Pixels are stored as they are
+in memory, so float formats only read back right on little-endian hosts.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <cstdio>
+#include <vector>
+#include "pixelformat.h"
+
+namespace Native
+{
+	enum Compression { NONE = 0, DEFLATE = 1 };
+
+	static const size_t HEADER_SIZE = 64;
+	static const size_t DATA_ALIGN = 64;	// Of data_offset, so mapped pixels can be used in place.
+	static const int TILE_SIZE = 256;
+
+	// Largest width, height or tile side read back.  Anything bigger is taken
+	// as a damaged file rather than allocated for.
+	static const int MAX_SIDE = 1 << 16;
+
+	// Deflate never expands data more than this.
+	static const unsigned long long MAX_DEFLATE_RATIO = 1032;
+
+	// Header flags.
+	static const unsigned short PREMULTIPLIED = 1;	// Colors are multiplied by alpha.
+
+	struct Header
+	{
+		PixelFormat format;
+		int width;
+		int height;
+		Compression compression;
+		unsigned short flags;
+		int tile_w;
+		int tile_h;
+		unsigned long long data_offset;
+		unsigned long long index_offset;
+
+		Header();
+
+		// Bytes of the whole image, uncompressed.  ReadHeader checks it fits.
+		size_t ImageBytes() const { return (size_t)width * height * Format::BytesPerPixel(format); }
+
+		int TilesX() const { return (tile_w) ? (width + tile_w - 1) / tile_w : 0; }
+		int TilesY() const { return (tile_h) ? (height + tile_h - 1) / tile_h : 0; }
+	};
+
+	struct Tile
+	{
+		unsigned long long offset;
+		unsigned long long length;
+	};
+
+	// Reads and checks the header: sizes in range, data_offset aligned past
+	// the header, and the pixels, or the index and what they could inflate
+	// to, within the file.
+	bool ReadHeader(FILE *fp, Header &h);
+	bool WriteHeader(FILE *fp, const Header &h);
+
+	// Reads the tile index, checking every tile lies within the file.
+	bool ReadIndex(FILE *fp, const Header &h, std::vector<Tile> &index);
+	bool WriteIndex(FILE *fp, const std::vector<Tile> &index);
+
+	// Deflates size bytes of src into out.
+	bool CompressTile(const unsigned char *src, size_t size, std::vector<unsigned char> &out);
+
+	// Inflates a tile of exactly size bytes into dst.
+	bool DecompressTile(const unsigned char *src, size_t length, unsigned char *dst, size_t size);
+
+	// 64 bit file positioning.
+	bool Seek(FILE *fp, unsigned long long offset);
+	unsigned long long Tell(FILE *fp);
+
+	// Size of the file, leaving the position where it was.
+	unsigned long long FileSize(FILE *fp);
+};
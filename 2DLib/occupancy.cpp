@@ -0,0 +1,112 @@
+/* --------------------------------------------------------------------------
+
+occupancy.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Summed-area table of the pixels a Mask counts as content.
+
+-----------------------------------------------------------------------------*/
+
+#include "occupancy.h"
+#include "threadpool.h"
+#include <algorithm>
+
+// Rows summed per task when refreshing.
+static const int BAND = 64;
+
+OccupancyIndex::OccupancyIndex(const Mask &m)
+	: mask(m)
+	, valid(0)
+{
+
+}
+
+OccupancyIndex::OccupancyIndex(const OccupancyIndex &o)
+	: mask(o.mask)
+{
+	std::lock_guard<std::mutex> lock(o.mutex);
+
+	size = o.size;
+	valid = o.valid;
+	sums = o.sums;
+}
+
+void OccupancyIndex::Invalidate(int top)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	valid = std::max(0, std::min(valid, top));
+}
+
+// Sums image rows valid .. rows - 1.  Each row gets its own prefix sums in
+// parallel, then rows are added to the one above in order.
+void OccupancyIndex::Refresh(const unsigned char *bits, PixelFormat pf, int rows)
+{
+	const size_t stride = (size_t)size.W + 1;
+	const int first = valid;
+	const int bands = (rows - first + BAND - 1) / BAND;
+
+	Format::Dispatch(pf, [&](auto f) {
+		typedef decltype(f) F;
+		const Format::MaskTest<F> test(mask);
+		const auto *px = (const typename F::Type *)bits;
+
+		ThreadPool::Shared().For(bands, [&](int band) {
+			int end = std::min(rows, first + (band + 1) * BAND);
+
+			for (int y = first + band * BAND; y < end; y++)
+			{
+				const auto *src = px + (size_t)y * size.W;
+				unsigned int *dst = &sums[(y + 1) * stride];
+				unsigned int sum = 0;
+
+				dst[0] = 0;
+
+				for (int x = 0; x < size.W; x++)
+				{
+					sum += test(src[x]) ? 1 : 0;
+					dst[x + 1] = sum;
+				}
+			}
+		});
+	});
+
+	for (int y = first; y < rows; y++)
+	{
+		const unsigned int *above = &sums[y * stride];
+		unsigned int *dst = &sums[(y + 1) * stride];
+
+		for (size_t x = 1; x < stride; x++)
+			dst[x] += above[x];
+	}
+
+	valid = rows;
+}
+
+unsigned int OccupancyIndex::Count(const unsigned char *bits, const Size &s, PixelFormat pf, const Rect &r)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (s.W != size.W || s.H != size.H)
+	{
+		size = s;
+		sums.assign(((size_t)size.W + 1) * ((size_t)size.H + 1), 0);
+		valid = 0;
+	}
+
+	if (r.right < r.left || r.bottom < r.top)
+		return 0;
+
+	if (r.bottom >= valid)
+		Refresh(bits, pf, r.bottom + 1);
+
+	const size_t stride = (size_t)size.W + 1;
+	const unsigned int *top = &sums[r.top * stride];
+	const unsigned int *bottom = &sums[(r.bottom + 1) * stride];
+
+	return bottom[r.right + 1] - bottom[r.left] - top[r.right + 1] + top[r.left];
+}
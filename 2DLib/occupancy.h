@@ -0,0 +1,55 @@
+/* --------------------------------------------------------------------------
+
+occupancy.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Summed-area table of the pixels a Mask counts as content, so the content
+of any rect is counted with 4 lookups.
+
+Changes are recorded as the first row they touch: everything above stays
+valid, and rows below are summed again the first time a query reaches
+them.  Counts are kept modulo 2^32, which still gives exact rect counts
+below that.
+
+Queries come through const Buffer methods, so several threads may ask at
+once: the catching up is done under a lock.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include "mask.h"
+#include "rect.h"
+
+class OccupancyIndex
+{
+	Mask mask;
+	Size size;
+	int valid;							// Image rows summed so far.
+	std::vector<unsigned int> sums;		// (W + 1) * (H + 1): content in [0, x) x [0, y).
+	mutable std::mutex mutex;			// Guards all of the above but the mask.
+
+	void Refresh(const unsigned char *bits, PixelFormat pf, int rows);
+
+	OccupancyIndex& operator = (const OccupancyIndex&);
+
+public:
+
+	explicit OccupancyIndex(const Mask &m);
+	OccupancyIndex(const OccupancyIndex &o);
+
+	const Mask &GetMask() const { return mask; }
+
+	// Rows from top down changed.
+	void Invalidate(int top);
+
+	// Content pixels in r, which must be inside the image of the given size.
+	unsigned int Count(const unsigned char *bits, const Size &s, PixelFormat pf, const Rect &r);
+};
@@ -0,0 +1,421 @@
+/* --------------------------------------------------------------------------
+
+orientation.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Flipping, rotating by quarter turns and transposing pixels.
+
+-----------------------------------------------------------------------------*/
+
+#include "orientation.h"
+#include "blit.h"
+#include "bufferview.h"
+#include "simd.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Side of the tiles turns go through, in pixels.
+static const int TILE = 64;
+
+// Images of at least this many bytes are split in bands over the pool.
+static const size_t PARALLEL_BYTES = 1 << 22;
+
+// Runs fn on bands 0 to n - 1, on the pool when there is enough work.
+template <class Fn>
+static void Bands(int n, size_t bytes, Fn fn)
+{
+	if (n > 1 && bytes >= PARALLEL_BYTES)
+		ThreadPool::Shared().For(n, fn);
+	else
+	{
+		for (int i = 0; i < n; i++)
+			fn(i);
+	}
+}
+
+// Turns the block [x0, x1) x [y0, y1) of src into dst: column x of src
+// becomes row x of dst, or row w - 1 - x with flip_rows, and row y of src
+// becomes column y, or column h - 1 - y with flip_cols.
+typedef void (*TurnKernel)(const BufferView& dst, const BufferView& src, int x0, int y0, int x1, int y1, bool flip_rows, bool flip_cols);
+
+template <class T>
+static void TurnBlock(const BufferView& dst, const BufferView& src, int x0, int y0, int x1, int y1, bool flip_rows, bool flip_cols)
+{
+	int w = src.GetSize().W, h = src.GetSize().H;
+
+	for (int x = x0; x < x1; x++)
+	{
+		T *out = (T *)dst.Row((flip_rows) ? w - 1 - x : x);
+
+		for (int y = y0; y < y1; y++)
+			out[(flip_cols) ? h - 1 - y : y] = ((const T *)src.Row(y))[x];
+	}
+}
+
+// Reverses n pixels of src into dst.
+typedef void (*ReverseKernel)(void *dst, const void *src, int n);
+
+template <class T>
+static void ReverseRow(void *dst, const void *src, int n)
+{
+	T *d = (T *)dst;
+	const T *s = (const T *)src;
+
+	for (int i = 0; i < n; i++)
+		d[i] = s[n - 1 - i];
+}
+
+#ifdef SIMD_X86
+
+// 4 byte pixels, a 4x4 block at a time: rows are loaded in registers,
+// transposed with unpacks and stored as columns.
+SIMD_SSE2 static void TurnBlock4SSE2(const BufferView& dst, const BufferView& src, int x0, int y0, int x1, int y1, bool flip_rows, bool flip_cols)
+{
+	int w = src.GetSize().W, h = src.GetSize().H;
+	int y = y0;
+
+	for (; y + 4 <= y1; y += 4)
+	{
+		const unsigned int *r = (const unsigned int *)src.Row(y);
+		size_t stride = src.GetStride() / 4;
+		int col = (flip_cols) ? h - 4 - y : y;
+		int x = x0;
+
+		for (; x + 4 <= x1; x += 4)
+		{
+			__m128i r0 = _mm_loadu_si128((const __m128i *)(r + x));
+			__m128i r1 = _mm_loadu_si128((const __m128i *)(r + stride + x));
+			__m128i r2 = _mm_loadu_si128((const __m128i *)(r + 2 * stride + x));
+			__m128i r3 = _mm_loadu_si128((const __m128i *)(r + 3 * stride + x));
+
+			__m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpacklo_epi32(r2, r3);
+			__m128i t2 = _mm_unpackhi_epi32(r0, r1), t3 = _mm_unpackhi_epi32(r2, r3);
+
+			__m128i c[4] = { _mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1), _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3) };
+
+			for (int i = 0; i < 4; i++)
+			{
+				__m128i v = (flip_cols) ? _mm_shuffle_epi32(c[i], _MM_SHUFFLE(0, 1, 2, 3)) : c[i];
+				_mm_storeu_si128((__m128i *)((unsigned int *)dst.Row((flip_rows) ? w - 1 - x - i : x + i) + col), v);
+			}
+		}
+
+		TurnBlock<unsigned int>(dst, src, x, y, x1, y + 4, flip_rows, flip_cols);
+	}
+
+	TurnBlock<unsigned int>(dst, src, x0, y, x1, y1, flip_rows, flip_cols);
+}
+
+// The same 8x8: unpacks within each 128 bit lane, then lanes swapped.
+SIMD_AVX2 static void TurnBlock4AVX2(const BufferView& dst, const BufferView& src, int x0, int y0, int x1, int y1, bool flip_rows, bool flip_cols)
+{
+	int w = src.GetSize().W, h = src.GetSize().H;
+	const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	int y = y0;
+
+	for (; y + 8 <= y1; y += 8)
+	{
+		const unsigned int *r = (const unsigned int *)src.Row(y);
+		size_t stride = src.GetStride() / 4;
+		int col = (flip_cols) ? h - 8 - y : y;
+		int x = x0;
+
+		for (; x + 8 <= x1; x += 8)
+		{
+			__m256i v[8], t[8];
+
+			for (int i = 0; i < 8; i++)
+				v[i] = _mm256_loadu_si256((const __m256i *)(r + i * stride + x));
+
+			for (int i = 0; i < 8; i += 2)
+			{
+				t[i] = _mm256_unpacklo_epi32(v[i], v[i + 1]);
+				t[i + 1] = _mm256_unpackhi_epi32(v[i], v[i + 1]);
+			}
+
+			for (int i = 0; i < 8; i += 4)
+			{
+				v[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+				v[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+				v[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+				v[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+			}
+
+			for (int i = 0; i < 4; i++)
+			{
+				t[i] = _mm256_permute2x128_si256(v[i], v[i + 4], 0x20);
+				t[i + 4] = _mm256_permute2x128_si256(v[i], v[i + 4], 0x31);
+			}
+
+			for (int i = 0; i < 8; i++)
+			{
+				__m256i c = (flip_cols) ? _mm256_permutevar8x32_epi32(t[i], reverse) : t[i];
+				_mm256_storeu_si256((__m256i *)((unsigned int *)dst.Row((flip_rows) ? w - 1 - x - i : x + i) + col), c);
+			}
+		}
+
+		TurnBlock<unsigned int>(dst, src, x, y, x1, y + 8, flip_rows, flip_cols);
+	}
+
+	TurnBlock4SSE2(dst, src, x0, y, x1, y1, flip_rows, flip_cols);
+}
+
+SIMD_SSE2 static void ReverseRow4SSE2(void *dst, const void *src, int n)
+{
+	unsigned int *d = (unsigned int *)dst;
+	const unsigned int *s = (const unsigned int *)src;
+	int i = 0;
+
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_si128((__m128i *)(d + i), _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(s + n - 4 - i)), _MM_SHUFFLE(0, 1, 2, 3)));
+
+	for (; i < n; i++)
+		d[i] = s[n - 1 - i];
+}
+
+SIMD_AVX2 static void ReverseRow4AVX2(void *dst, const void *src, int n)
+{
+	unsigned int *d = (unsigned int *)dst;
+	const unsigned int *s = (const unsigned int *)src;
+	const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_si256((__m256i *)(d + i), _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)(s + n - 8 - i)), reverse));
+
+	for (; i < n; i++)
+		d[i] = s[n - 1 - i];
+}
+
+#endif
+
+template <class T>
+static TurnKernel PickTurn()
+{
+#ifdef SIMD_X86
+	if (sizeof(T) == 4)
+		return (SIMD::HasAVX2()) ? &TurnBlock4AVX2 : &TurnBlock4SSE2;
+#endif
+	return &TurnBlock<T>;
+}
+
+template <class T>
+static ReverseKernel PickReverse()
+{
+#ifdef SIMD_X86
+	if (sizeof(T) == 4)
+		return (SIMD::HasAVX2()) ? &ReverseRow4AVX2 : &ReverseRow4SSE2;
+#endif
+	return &ReverseRow<T>;
+}
+
+// Transposes src into dst, with the flips of TurnBlock, a tile at a time.
+// Tiles are taken by bands of source rows, which write separate columns.
+template <class T>
+static void Turn(const BufferView& dst, const BufferView& src, bool flip_rows, bool flip_cols)
+{
+	static const TurnKernel kernel = PickTurn<T>();
+	int w = src.GetSize().W, h = src.GetSize().H;
+
+	Bands((h + TILE - 1) / TILE, (size_t)w * h * sizeof(T), [&](int b) {
+		int y0 = b * TILE, y1 = std::min(h, y0 + TILE);
+
+		for (int x0 = 0; x0 < w; x0 += TILE)
+			kernel(dst, src, x0, y0, std::min(w, x0 + TILE), y1, flip_rows, flip_cols);
+	});
+}
+
+template <class T>
+static void Flip(const BufferView& dst, const BufferView& src, bool flip_h, bool flip_v)
+{
+	static const ReverseKernel reverse = PickReverse<T>();
+	int w = src.GetSize().W, h = src.GetSize().H;
+
+	Bands((h + TILE - 1) / TILE, (size_t)w * h * sizeof(T), [&](int b) {
+		for (int y = b * TILE; y < std::min(h, (b + 1) * TILE); y++)
+		{
+			const unsigned char *s = src.Row((flip_v) ? h - 1 - y : y);
+
+			if (flip_h)
+				reverse(dst.Row(y), s, w);
+			else
+				memcpy(dst.Row(y), s, w * sizeof(T));
+		}
+	});
+}
+
+// Rows are swapped in pairs from both ends, through copies of both.
+template <class T>
+static void FlipInPlace(const BufferView& v, bool flip_h, bool flip_v)
+{
+	static const ReverseKernel reverse = PickReverse<T>();
+	int w = v.GetSize().W, h = v.GetSize().H;
+	int pairs = (flip_v) ? (h + 1) / 2 : h;
+
+	Bands((pairs + TILE - 1) / TILE, (size_t)w * h * sizeof(T), [&](int b) {
+		std::vector<T> top(w), bottom(w);
+
+		for (int y = b * TILE; y < std::min(pairs, (b + 1) * TILE); y++)
+		{
+			int other = (flip_v) ? h - 1 - y : y;
+
+			memcpy(top.data(), v.Row(y), w * sizeof(T));
+			memcpy(bottom.data(), v.Row(other), w * sizeof(T));
+
+			if (flip_h)
+			{
+				reverse(v.Row(y), bottom.data(), w);
+				reverse(v.Row(other), top.data(), w);
+			}
+			else
+			{
+				memcpy(v.Row(y), bottom.data(), w * sizeof(T));
+				memcpy(v.Row(other), top.data(), w * sizeof(T));
+			}
+		}
+	});
+}
+
+// Tiles across the diagonal are swapped in pairs, each turned into the
+// other's place from a copy of one of them.
+template <class T>
+static void TransposeInPlace(const BufferView& v)
+{
+	int n = v.GetSize().W, tiles = (n + TILE - 1) / TILE;
+
+	Bands(tiles, (size_t)n * n * sizeof(T), [&](int i) {
+		std::vector<T> copy(TILE * TILE);
+
+		for (int j = i; j < tiles; j++)
+		{
+			Size s(std::min(TILE, n - j * TILE), std::min(TILE, n - i * TILE));
+			BufferView a = v.Sub(Rect(Point(j * TILE, i * TILE), s));
+			BufferView b = v.Sub(Rect(Point(i * TILE, j * TILE), Size(s.H, s.W)));
+			BufferView c(copy.data(), s, v.GetFormat());
+
+			c.CopyFrom(a);
+
+			if (i != j)
+				Turn<T>(a, b, false, false);
+
+			Turn<T>(b, c, false, false);
+		}
+	});
+}
+
+Size Orientation::Result(const Size& s, Op op)
+{
+	return (IsTurn(op)) ? Size(s.H, s.W) : s;
+}
+
+Point Orientation::Source(const Point& p, const Size& s, Op op)
+{
+	switch (op)
+	{
+	case FLIP_H:		return Point(s.W - 1 - p.X, p.Y);
+	case FLIP_V:		return Point(p.X, s.H - 1 - p.Y);
+	case ROTATE_90:		return Point(p.Y, s.H - 1 - p.X);
+	case ROTATE_180:	return Point(s.W - 1 - p.X, s.H - 1 - p.Y);
+	case ROTATE_270:	return Point(s.W - 1 - p.Y, p.X);
+	default:			return Point(p.Y, p.X);
+	}
+}
+
+void Orientation::Apply(const BufferView& dst, const BufferView& src, Op op)
+{
+	Size r = Result(src.GetSize(), op);
+	int w = std::min(dst.GetSize().W, r.W), h = std::min(dst.GetSize().H, r.H);
+
+	if (w <= 0 || h <= 0 || src.IsEmpty())
+		return;
+
+	// Only the part of src that lands in dst.
+	BufferView d = dst.Sub(Rect(Point(0, 0), Size(w, h))), s = src;
+
+	if (w < r.W || h < r.H)
+	{
+		Point a = Source(Point(0, 0), src.GetSize(), op), b = Source(Point(w - 1, h - 1), src.GetSize(), op);
+		s = src.Sub(Rect(Point(std::min(a.X, b.X), std::min(a.Y, b.Y)), Point(std::max(a.X, b.X), std::max(a.Y, b.Y))));
+	}
+
+	PixelFormat df = d.GetFormat(), sf = s.GetFormat();
+	size_t dst_row = w * Format::BytesPerPixel(df), src_row = s.GetSize().W * Format::BytesPerPixel(sf);
+
+	const unsigned char *dst_begin = d.Row(0), *dst_end = d.Row(h - 1) + dst_row;
+	const unsigned char *src_begin = s.Row(0), *src_end = s.Row(s.GetSize().H - 1) + src_row;
+
+	if (dst_begin < src_end && src_begin < dst_end)
+	{
+		if (dst_begin == src_begin && df == sf && d.GetStride() == s.GetStride() && d.GetSize().W == s.GetSize().W && d.GetSize().H == s.GetSize().H)
+		{
+			Apply(d, op);
+			return;
+		}
+
+		// Work from a copy of the source.
+		std::vector<unsigned char> copy(src_row * s.GetSize().H);
+		BufferView c(copy.data(), s.GetSize(), sf);
+
+		c.CopyFrom(s);
+		Apply(d, c, op);
+		return;
+	}
+
+	if (df != sf)
+	{
+		// Turned in the source format, then converted.
+		std::vector<unsigned char> tmp((size_t)w * h * Format::BytesPerPixel(sf));
+		BufferView t(tmp.data(), Size(w, h), sf);
+
+		Apply(t, s, op);
+		Blit::Copy(d, t);
+		return;
+	}
+
+	Format::Dispatch(sf, [&](auto f) {
+		typedef typename decltype(f)::Type T;
+
+		switch (op)
+		{
+		case FLIP_H:		Flip<T>(d, s, true, false); break;
+		case FLIP_V:		Flip<T>(d, s, false, true); break;
+		case ROTATE_90:		Turn<T>(d, s, false, true); break;
+		case ROTATE_180:	Flip<T>(d, s, true, true); break;
+		case ROTATE_270:	Turn<T>(d, s, true, false); break;
+		default:			Turn<T>(d, s, false, false); break;
+		}
+	});
+}
+
+bool Orientation::Apply(const BufferView& v, Op op)
+{
+	if (IsTurn(op) && v.GetSize().W != v.GetSize().H)
+		return false;
+
+	if (v.IsEmpty())
+		return true;
+
+	// A quarter turn of a square is its transpose, flipped.
+	Format::Dispatch(v.GetFormat(), [&](auto f) {
+		typedef typename decltype(f)::Type T;
+
+		switch (op)
+		{
+		case FLIP_H:		FlipInPlace<T>(v, true, false); break;
+		case FLIP_V:		FlipInPlace<T>(v, false, true); break;
+		case ROTATE_90:		TransposeInPlace<T>(v); FlipInPlace<T>(v, true, false); break;
+		case ROTATE_180:	FlipInPlace<T>(v, true, true); break;
+		case ROTATE_270:	TransposeInPlace<T>(v); FlipInPlace<T>(v, false, true); break;
+		default:			TransposeInPlace<T>(v); break;
+		}
+	});
+
+	return true;
+}
@@ -0,0 +1,48 @@
+/* --------------------------------------------------------------------------
+
+orientation.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Flipping, rotating by quarter turns and transposing pixels.
+
+Flips move whole rows, reversing them when flipping horizontally.  Turns
+go through tiles of 64x64 pixels so both the rows read and the columns
+written stay in cache, and 4 byte pixels are transposed 4x4 in SSE2
+registers, or 8x8 with AVX2.  Big images are done in bands of tiles on
+the shared pool.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "rect.h"
+
+class BufferView;
+
+namespace Orientation
+{
+	// Rotations are clockwise.
+	enum Op { FLIP_H, FLIP_V, ROTATE_90, ROTATE_180, ROTATE_270, TRANSPOSE };
+
+	// Rotating a quarter turn and transposing swap the width and height.
+	inline bool IsTurn(Op op) { return op == ROTATE_90 || op == ROTATE_270 || op == TRANSPOSE; }
+
+	// Size of an image of size s once op is done.
+	Size Result(const Size& s, Op op);
+
+	// The pixel of an image of size s that ends up at p once op is done.
+	Point Source(const Point& p, const Size& s, Op op);
+
+	// Writes src, once op is done, into dst from the top left corner, as far
+	// as both go.  Formats can differ, and the two can share pixels.
+	void Apply(const BufferView& dst, const BufferView& src, Op op);
+
+	// Does op on v where it is.  Turns need a square view: returns false and
+	// leaves others alone.
+	bool Apply(const BufferView& v, Op op);
+};
@@ -0,0 +1,197 @@
+/* --------------------------------------------------------------------------
+
+pipeline.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Overlapped load -> process -> save over a list of files.
+
+-----------------------------------------------------------------------------*/
+
+#include "pipeline.h"
+#include "threadpool.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+struct Work
+{
+	Pipeline::Item item;
+	Batch::Result result;
+};
+
+// Queue between two stages.  Push() waits for room, Pop() for an item or
+// for the queue to be closed.
+class BoundedQueue
+{
+	std::deque<std::unique_ptr<Work>> items;
+	size_t capacity;
+	bool closed;
+	std::mutex mutex;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+
+public:
+
+	explicit BoundedQueue(size_t c) : capacity(c), closed(false) { }
+
+	void Push(std::unique_ptr<Work> w)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [this]() { return items.size() < capacity; });
+		items.push_back(std::move(w));
+		not_empty.notify_one();
+	}
+
+	bool Pop(std::unique_ptr<Work> &w)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [this]() { return closed || !items.empty(); });
+
+		if (items.empty())
+			return false;
+
+		w = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_empty.notify_all();
+	}
+};
+
+Pipeline::Pipeline(size_t c)
+	: capacity((c) ? c : 1)
+{
+
+}
+
+Pipeline &Pipeline::Load(PixelFormat pf, int workers)
+{
+	return Then([pf](Item &it) {
+		it.buffer = Buffer(pf);
+
+		if (!it.buffer.Load(it.filename))
+			throw std::runtime_error("Unsupported or unreadable file");
+	}, workers);
+}
+
+Pipeline &Pipeline::Then(const Stage &fn, int workers)
+{
+	Step s = { fn, (workers > 0) ? workers : ThreadPool::Shared().GetSize() };
+	steps.push_back(s);
+	return *this;
+}
+
+Pipeline &Pipeline::Save(const std::function<std::string(const Item &)> &name, bool with_alpha, bool compress, int workers)
+{
+	return Then([=](Item &it) {
+		if (!it.buffer.Save(name(it), with_alpha, compress))
+			throw std::runtime_error("Unsupported file type");
+
+		// Nothing downstream needs the pixels.
+		it.buffer = Buffer();
+	}, workers);
+}
+
+std::vector<Batch::Result> Pipeline::Run(const std::vector<std::string> &files)
+{
+	std::vector<std::unique_ptr<BoundedQueue>> queues;
+
+	for (size_t i = 0; i <= steps.size(); i++)
+		queues.emplace_back(new BoundedQueue(capacity));
+
+	std::vector<std::thread> threads;
+
+	// Feeding the first queue blocks once it is full.
+	threads.emplace_back([&]() {
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			std::unique_ptr<Work> w(new Work);
+			w->item.index = i;
+			w->item.filename = files[i];
+			w->result.ok = true;
+			queues[0]->Push(std::move(w));
+		}
+
+		queues[0]->Close();
+	});
+
+	// Workers still running in each stage.  All made before any worker
+	// starts, as workers read them while later stages are being set up.
+	std::vector<std::unique_ptr<std::atomic<int>>> left;
+
+	for (size_t k = 0; k < steps.size(); k++)
+		left.emplace_back(new std::atomic<int>(steps[k].workers));
+
+	for (size_t k = 0; k < steps.size(); k++)
+	{
+		for (int t = 0; t < steps[k].workers; t++)
+		{
+			threads.emplace_back([&, k]() {
+				std::unique_ptr<Work> w;
+
+				while (queues[k]->Pop(w))
+				{
+					if (w->result.ok)
+					{
+						try
+						{
+							steps[k].fn(w->item);
+						}
+						catch (PNG_Exception &e)
+						{
+							w->result.ok = false;
+							w->result.error = e.GetError();
+						}
+						catch (std::exception &e)
+						{
+							w->result.ok = false;
+							w->result.error = e.what();
+						}
+						catch (...)
+						{
+							w->result.ok = false;
+							w->result.error = "Unknown error";
+						}
+
+						// A failed item does not hold on to its pixels.
+						if (!w->result.ok)
+							w->item.buffer = Buffer();
+					}
+
+					queues[k + 1]->Push(std::move(w));
+				}
+
+				// The last worker of a stage out closes the way to the next.
+				if (--*left[k] == 0)
+					queues[k + 1]->Close();
+			});
+		}
+	}
+
+	std::vector<Batch::Result> results(files.size());
+	std::unique_ptr<Work> w;
+
+	while (queues.back()->Pop(w))
+		results[w->item.index] = w->result;
+
+	for (auto &t : threads)
+		t.join();
+
+	return results;
+}
@@ -0,0 +1,72 @@
+/* --------------------------------------------------------------------------
+
+pipeline.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Overlapped load -> process -> save over a list of files.
+
+Each stage has its own threads and hands items to the next one through a
+queue holding at most capacity items.  A full queue blocks the stage
+feeding it, so a slow encoder holds back the loaders instead of letting
+decoded images pile up, and disk waits in one stage hide behind work in
+the others.
+
+	Pipeline p;
+	p.Load(RGBA8).Then([&](Pipeline::Item &it) { ... }).Save([](const Pipeline::Item &it) { return it.filename + ".out.png"; });
+	auto results = p.Run(files);
+
+A stage fails an item by throwing; the item then skips the stages left.
+Stages with more than one worker see items out of order and must not share
+state without a lock.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "batch.h"
+#include "buffer.h"
+
+class Pipeline
+{
+public:
+
+	struct Item
+	{
+		size_t index;			// In the list given to Run().
+		std::string filename;
+		Buffer buffer;
+	};
+
+	typedef std::function<void(Item &)> Stage;
+
+protected:
+
+	struct Step
+	{
+		Stage fn;
+		int workers;
+	};
+
+	std::vector<Step> steps;
+	size_t capacity;
+
+public:
+
+	explicit Pipeline(size_t capacity = 4);
+
+	// 0 workers means one per core.
+	Pipeline &Load(PixelFormat pf = RGBA32F, int workers = 0);
+	Pipeline &Then(const Stage &fn, int workers = 1);
+	Pipeline &Save(const std::function<std::string(const Item &)> &name, bool with_alpha = true, bool compress = false, int workers = 0);
+
+	// Pushes every file through the stages and returns how each went.
+	std::vector<Batch::Result> Run(const std::vector<std::string> &files);
+};
@@ -0,0 +1,47 @@
+/* --------------------------------------------------------------------------
+
+pixelexpr.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Per-pixel color operations chained at compile time and run in one pass.
+
+-----------------------------------------------------------------------------*/
+
+#include "pixelexpr.h"
+#include <cstdio>
+
+bool PixelExpr::SavePNG(const std::string &filename, const Size& s, bool with_alpha, const PNGWriter::Options &opt,
+	const std::function<void(int, Color *)> &rows)
+{
+	PixelFormat file_format = (with_alpha) ? RGBA8 : RGB8;
+
+	// The writer asks for rows from several threads.
+	auto source = [&](int y, unsigned char *scratch) -> const unsigned char * {
+		thread_local std::vector<Color> row;
+		row.resize(s.W);
+
+		rows(y, row.data());
+		Format::ConvertRow(RGBA32F, row.data(), file_format, scratch, s.W);
+		return scratch;
+	};
+
+	FILE *fp = fopen(filename.c_str(), "wb");
+
+	if (!fp)
+		throw(PNG_Exception(filename, "[write_png_file] File %s could not be opened for writing"));
+
+	bool ok = PNGWriter::Write(fp, s.W, s.H, (with_alpha) ? 4 : 3, source, opt);
+
+	if (fclose(fp) != 0)
+		ok = false;
+
+	if (!ok)
+		throw(PNG_Exception(filename, "[write_png_file] Error during writing bytes"));
+
+	return true;
+}
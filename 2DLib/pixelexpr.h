@@ -0,0 +1,279 @@
+/* --------------------------------------------------------------------------
+
+pixelexpr.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Per-pixel color operations chained at compile time and run in one pass.
+
+	PixelExpr::Apply(buffer, PixelExpr::Sanitize() | PixelExpr::Levels(0.1f, 0.9f) | PixelExpr::Grayscale());
+
+An expression is a chain of small function objects the compiler inlines
+into one loop.  Nothing happens until it is applied: each row is read once,
+converted to colors, put through the whole chain and written back, on the
+shared thread pool.  It can also go straight to another view, raw data or
+a file, without an intermediate buffer.
+
+Operations work on straight colors between 0 and 1, so 8 bit results can
+differ by a step from Buffer's own methods, which work on the bytes.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+#include "buffer.h"
+#include "bufferview.h"
+#include "pixelops.h"
+
+namespace PixelExpr
+{
+	// Base of all expressions, D being the expression itself.
+	template <class D>
+	struct Op
+	{
+		inline const D& Self() const { return static_cast<const D&>(*this); }
+	};
+
+	// a, then b.
+	template <class A, class B>
+	struct Chain : Op<Chain<A, B>>
+	{
+		A a;
+		B b;
+
+		Chain(const A& first, const B& then) : a(first), b(then) { }
+
+		inline Color operator () (const Color& c) const { return b(a(c)); }
+	};
+
+	template <class A, class B>
+	inline Chain<A, B> operator | (const Op<A>& a, const Op<B>& b)
+	{
+		return Chain<A, B>(a.Self(), b.Self());
+	}
+
+	// Fully transparent pixels become NoAlpha, as Buffer::Sanitize().
+	struct Sanitize : Op<Sanitize>
+	{
+		inline Color operator () (const Color& c) const { return (c.a == 0.f) ? RGBA::NoAlpha : c; }
+	};
+
+	// Pixels with less alpha than t become bg, as Buffer::FullAlpha().
+	struct FullAlpha : Op<FullAlpha>
+	{
+		Color bg;
+		float t;
+
+		FullAlpha(const Color& c, float threshold = 1.f) : bg(c), t(threshold) { }
+
+		inline Color operator () (const Color& c) const { return (c.a < t) ? bg : c; }
+	};
+
+	// Luminance in r g b, as Buffer::Grayscale().
+	struct Grayscale : Op<Grayscale>
+	{
+		inline Color operator () (const Color& c) const
+		{
+			float v = c.r * 0.222f + c.g * 0.707f + c.b * 0.071f;
+			return Color(v, v, v, c.a);
+		}
+	};
+
+	// Maps [in_low, in_high] to [out_low, out_high] on r g b, with a gamma
+	// in between, as image editors do.
+	struct Levels : Op<Levels>
+	{
+		float in_low, scale, inv_gamma, out_low, out_range;
+
+		Levels(float in_l, float in_h, float gamma = 1.f, float out_l = 0.f, float out_h = 1.f)
+			: in_low(in_l)
+			, scale((in_h > in_l) ? 1.f / (in_h - in_l) : 0.f)
+			, inv_gamma(1.f / gamma)
+			, out_low(out_l)
+			, out_range(out_h - out_l)
+		{ }
+
+		inline float Channel(float v) const
+		{
+			v = std::min(std::max((v - in_low) * scale, 0.f), 1.f);
+
+			if (inv_gamma != 1.f)
+				v = std::pow(v, inv_gamma);
+
+			return out_low + v * out_range;
+		}
+
+		inline Color operator () (const Color& c) const { return Color(Channel(c.r), Channel(c.g), Channel(c.b), c.a); }
+	};
+
+	// Channels picked from the source: 0 red, 1 green, 2 blue, 3 alpha.
+	struct Swizzle : Op<Swizzle>
+	{
+		int r, g, b, a;
+
+		Swizzle(int red, int green, int blue, int alpha) : r(red), g(green), b(blue), a(alpha) { }
+
+		inline Color operator () (const Color& c) const { return Color(c[r], c[g], c[b], c[a]); }
+	};
+
+	// r g b multiplied by a color, amount mixing between the original and the
+	// tinted color.
+	struct Tint : Op<Tint>
+	{
+		Color tint;
+		float amount;
+
+		Tint(const Color& c, float k = 1.f) : tint(c), amount(k) { }
+
+		inline Color operator () (const Color& c) const
+		{
+			Color t = c * tint;
+			Color o = c + (t - c) * amount;
+			o.a = c.a;
+			return o;
+		}
+	};
+
+	// White where the luminance is at least t, black elsewhere.  Alpha is kept.
+	struct Threshold : Op<Threshold>
+	{
+		float t;
+
+		Threshold(float threshold = 0.5f) : t(threshold) { }
+
+		inline Color operator () (const Color& c) const
+		{
+			float v = (c.r * 0.222f + c.g * 0.707f + c.b * 0.071f >= t) ? 1.f : 0.f;
+			return Color(v, v, v, c.a);
+		}
+	};
+
+	// Between straight and premultiplied alpha.
+	struct Premultiply : Op<Premultiply>
+	{
+		inline Color operator () (const Color& c) const { return Color(c.r * c.a, c.g * c.a, c.b * c.a, c.a); }
+	};
+
+	struct Unpremultiply : Op<Unpremultiply>
+	{
+		inline Color operator () (const Color& c) const
+		{
+			return (c.a > 0.f) ? Color(c.r / c.a, c.g / c.a, c.b / c.a, c.a) : RGBA::NoAlpha;
+		}
+	};
+
+	// Writes a PNG row by row, rows(y, colors) giving row y.  Throws like
+	// Buffer's PNG saving.
+	bool SavePNG(const std::string &filename, const Size& s, bool with_alpha, const PNGWriter::Options &opt,
+		const std::function<void(int, Color *)> &rows);
+
+	// Runs e over row y of src into a row of colors.
+	template <class E>
+	inline void EvalRow(const BufferView& src, int y, int x, int w, const E& e, Color *out)
+	{
+		if (src.GetFormat() == RGBA32F)
+			memcpy(out, src.Row<Format::RGBA32F>(y) + x, w * sizeof(Color));
+		else
+			Format::ConvertRow(src.GetFormat(), src.Row(y) + x * Format::BytesPerPixel(src.GetFormat()), RGBA32F, out, w);
+
+		for (int i = 0; i < w; i++)
+			out[i] = e(out[i]);
+	}
+
+	// src through e into dst, from the top left corner, as far as both go.
+	// dst can be src itself, but no other view overlapping it.
+	template <class E>
+	void Apply(const BufferView& src, const Op<E>& expr, const BufferView& dst)
+	{
+		const E &e = expr.Self();
+		Size s(std::min(src.GetSize().W, dst.GetSize().W), std::min(src.GetSize().H, dst.GetSize().H));
+		size_t bpp = std::max(Format::BytesPerPixel(src.GetFormat()), Format::BytesPerPixel(dst.GetFormat()));
+		std::vector<Rect> tiles = PixelOps::Tiles(s, bpp);
+
+		ThreadPool::Shared().For((int)tiles.size(), [&](int i) {
+			const Rect &t = tiles[i];
+			int w = t.GetWidth();
+
+			if (src.GetFormat() == RGBA32F && dst.GetFormat() == RGBA32F)
+			{
+				for (int y = t.top; y <= t.bottom; y++)
+				{
+					const Color *in = src.Row<Format::RGBA32F>(y) + t.left;
+					Color *out = dst.Row<Format::RGBA32F>(y) + t.left;
+
+					for (int x = 0; x < w; x++)
+						out[x] = e(in[x]);
+				}
+
+				return;
+			}
+
+			std::vector<Color> row(w);
+
+			for (int y = t.top; y <= t.bottom; y++)
+			{
+				EvalRow(src, y, t.left, w, e, row.data());
+				Format::ConvertRow(RGBA32F, row.data(), dst.GetFormat(), dst.Row(y) + t.left * Format::BytesPerPixel(dst.GetFormat()), w);
+			}
+		});
+	}
+
+	template <class E>
+	void Apply(const BufferView& v, const Op<E>& e)
+	{
+		Apply(v, e, v);
+	}
+
+	// Premultiplied buffers are unpremultiplied and premultiplied again
+	// around e, in the same pass.
+	template <class E>
+	void Apply(Buffer& b, const Op<E>& e)
+	{
+		if (b.IsPremultiplied())
+			Apply(BufferView(b), Unpremultiply() | e | Premultiply());
+		else
+			Apply(BufferView(b), e);
+
+		b.Touched(Rect(Point(0, 0), b.GetSize()));
+	}
+
+	// The result as 8 bit RGB (size 3) or RGBA (size 4), laid out as
+	// Buffer::GetData().  v is a view: its values are taken as they are.
+	template <class E>
+	void GetData(const BufferView& v, const Op<E>& e, std::vector<unsigned char> &data, size_t size)
+	{
+		data.clear();
+		data.resize(v.GetSize().W * v.GetSize().H * size);
+
+		if (!data.empty())
+			Apply(v, e, BufferView(data.data(), v.GetSize(), (size == 4) ? RGBA8 : RGB8));
+	}
+
+	// Saves the result.  PNGs are encoded as the rows are computed; other
+	// files go through a buffer of v's format.
+	template <class E>
+	bool Save(const BufferView& v, const Op<E>& expr, const std::string &filename, bool with_alpha = true, bool compress = false)
+	{
+		const E &e = expr.Self();
+
+		if (filename.substr(filename.size() - 4) == ".png")
+		{
+			return SavePNG(filename, v.GetSize(), with_alpha, PNGWriter::Options((compress) ? 9 : 6),
+				[&](int y, Color *row) { EvalRow(v, y, 0, v.GetSize().W, e, row); });
+		}
+
+		Buffer out(v.GetSize(), RGBA::NoAlpha, v.GetFormat());
+		Apply(v, e, BufferView(out));
+
+		return out.Save(filename, with_alpha, compress);
+	}
+};
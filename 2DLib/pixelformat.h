@@ -0,0 +1,336 @@
+/* --------------------------------------------------------------------------
+
+pixelformat.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Pixel formats a Buffer can be stored in, and their compile-time traits.
+
+Each format in the Format namespace describes its in-memory Type and how to
+go to and from a "work" value: a packed Pixel for 8 bit formats, a Color for
+float formats.  Kernels are written once as templates over a format and
+Format::Dispatch() picks the right instantiation, once per call.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <cstring>
+#include <type_traits>
+#include <glm/gtc/packing.hpp>
+#include "color.h"
+
+enum PixelFormat { RGBA8, RGB8, BGRA8, BGR8, A8, RGBA32F, RGBA16F };
+
+// In-memory pixel types for the formats that are not a Pixel or a Color.
+struct PixelRGB
+{
+	unsigned char r, g, b;
+
+	bool operator == (const PixelRGB& p) const { return r == p.r && g == p.g && b == p.b; }
+	bool operator != (const PixelRGB& p) const { return !(*this == p); }
+};
+
+struct PixelBGRA
+{
+	unsigned char b, g, r, a;
+
+	bool operator == (const PixelBGRA& p) const { return r == p.r && g == p.g && b == p.b && a == p.a; }
+	bool operator != (const PixelBGRA& p) const { return !(*this == p); }
+};
+
+struct PixelBGR
+{
+	unsigned char b, g, r;
+
+	bool operator == (const PixelBGR& p) const { return r == p.r && g == p.g && b == p.b; }
+	bool operator != (const PixelBGR& p) const { return !(*this == p); }
+};
+
+struct PixelHalf
+{
+	unsigned short r, g, b, a;
+
+	bool operator == (const PixelHalf& p) const { return r == p.r && g == p.g && b == p.b && a == p.a; }
+	bool operator != (const PixelHalf& p) const { return !(*this == p); }
+};
+
+namespace Format
+{
+	// 8 bits per channel, R G B A.  Same layout as Pixel.
+	struct RGBA8
+	{
+		typedef Pixel Type;
+		typedef Pixel Work;
+		static const PixelFormat ID = ::RGBA8;
+		static const int Components = 4;		// Bytes per pixel for R G B (A) byte layouts, else 0.
+		static const bool IsBGR = false;
+		static const bool IsFloat = false;
+		static const bool HasAlpha = true;
+
+		static inline Work ToWork(const Type& t) { return t; }
+		static inline Type FromWork(const Work& w) { return w; }
+	};
+
+	// 8 bits per channel, R G B.  Alpha reads as opaque.
+	struct RGB8
+	{
+		typedef PixelRGB Type;
+		typedef Pixel Work;
+		static const PixelFormat ID = ::RGB8;
+		static const int Components = 3;
+		static const bool IsBGR = false;
+		static const bool IsFloat = false;
+		static const bool HasAlpha = false;
+
+		static inline Work ToWork(const Type& t) { Work w = { t.r, t.g, t.b, 255 }; return w; }
+		static inline Type FromWork(const Work& w) { Type t = { w.r, w.g, w.b }; return t; }
+	};
+
+	// 8 bits per channel, B G R A, as found in TGA files.
+	struct BGRA8
+	{
+		typedef PixelBGRA Type;
+		typedef Pixel Work;
+		static const PixelFormat ID = ::BGRA8;
+		static const int Components = 4;
+		static const bool IsBGR = true;
+		static const bool IsFloat = false;
+		static const bool HasAlpha = true;
+
+		static inline Work ToWork(const Type& t) { Work w = { t.r, t.g, t.b, t.a }; return w; }
+		static inline Type FromWork(const Work& w) { Type t = { w.b, w.g, w.r, w.a }; return t; }
+	};
+
+	// 8 bits per channel, B G R, as found in 24 bit TGA files.  Alpha reads as opaque.
+	struct BGR8
+	{
+		typedef PixelBGR Type;
+		typedef Pixel Work;
+		static const PixelFormat ID = ::BGR8;
+		static const int Components = 3;
+		static const bool IsBGR = true;
+		static const bool IsFloat = false;
+		static const bool HasAlpha = false;
+
+		static inline Work ToWork(const Type& t) { Work w = { t.r, t.g, t.b, 255 }; return w; }
+		static inline Type FromWork(const Work& w) { Type t = { w.b, w.g, w.r }; return t; }
+	};
+
+	// 8 bit alpha only, 1 byte per pixel.  Reads as black with that alpha.
+	struct A8
+	{
+		typedef unsigned char Type;
+		typedef Pixel Work;
+		static const PixelFormat ID = ::A8;
+		static const int Components = 0;
+		static const bool IsBGR = false;
+		static const bool IsFloat = false;
+		static const bool HasAlpha = true;
+
+		static inline Work ToWork(const Type& t) { Work w = { 0, 0, 0, t }; return w; }
+		static inline Type FromWork(const Work& w) { return w.a; }
+	};
+
+	// 32 bit float per channel.  Same layout as Color.
+	struct RGBA32F
+	{
+		typedef Color Type;
+		typedef Color Work;
+		static const PixelFormat ID = ::RGBA32F;
+		static const int Components = 0;
+		static const bool IsBGR = false;
+		static const bool IsFloat = true;
+		static const bool HasAlpha = true;
+
+		static inline Work ToWork(const Type& t) { return t; }
+		static inline Type FromWork(const Work& w) { return w; }
+	};
+
+	// 16 bit (half) float per channel.
+	struct RGBA16F
+	{
+		typedef PixelHalf Type;
+		typedef Color Work;
+		static const PixelFormat ID = ::RGBA16F;
+		static const int Components = 0;
+		static const bool IsBGR = false;
+		static const bool IsFloat = true;
+		static const bool HasAlpha = true;
+
+		static inline Work ToWork(const Type& t)
+		{
+			return Color(glm::unpackHalf1x16(t.r), glm::unpackHalf1x16(t.g), glm::unpackHalf1x16(t.b), glm::unpackHalf1x16(t.a));
+		}
+
+		static inline Type FromWork(const Work& w)
+		{
+			Type t = { glm::packHalf1x16(w.r), glm::packHalf1x16(w.g), glm::packHalf1x16(w.b), glm::packHalf1x16(w.a) };
+			return t;
+		}
+	};
+
+	// Work value conversions.
+	inline Pixel ToPixel(const Pixel& w) { return w; }
+	inline Pixel ToPixel(const Color& w) { return RGBA::Pack(w); }
+	inline Color ToColor(const Pixel& w) { return RGBA::Unpack(w); }
+	inline Color ToColor(const Color& w) { return w; }
+
+	inline bool IsTransparent(const Pixel& w) { return w.a == 0; }
+	inline bool IsTransparent(const Color& w) { return w.a == 0.f; }
+
+	template <class W> W FromColor(const Color& c);
+	template <> inline Pixel FromColor<Pixel>(const Color& c) { return RGBA::Pack(c); }
+	template <> inline Color FromColor<Color>(const Color& c) { return c; }
+
+	template <class W> W FromPixel(const Pixel& p);
+	template <> inline Pixel FromPixel<Pixel>(const Pixel& p) { return p; }
+	template <> inline Color FromPixel<Color>(const Pixel& p) { return RGBA::Unpack(p); }
+
+	// Color <-> stored type for format F.
+	template <class F>
+	inline typename F::Type Store(const Color& c)
+	{
+		return F::FromWork(FromColor<typename F::Work>(c));
+	}
+
+	template <class F>
+	inline Color Load(const typename F::Type& t)
+	{
+		return ToColor(F::ToWork(t));
+	}
+
+	// A color as it reads back once stored in format F, in F's work type.
+	// Kernels compare pixels against this to find a given color.
+	template <class F>
+	inline typename F::Work Quantize(const Color& c)
+	{
+		return F::ToWork(Store<F>(c));
+	}
+
+	// Convert one pixel from format S to format D.  Between 8 bit formats this
+	// goes through a Pixel, otherwise through a Color.
+	template <class S, class D, bool Float = S::IsFloat || D::IsFloat>
+	struct Converter
+	{
+		static inline typename D::Type Convert(const typename S::Type& s)
+		{
+			return D::FromWork(FromColor<typename D::Work>(ToColor(S::ToWork(s))));
+		}
+	};
+
+	template <class S, class D>
+	struct Converter<S, D, false>
+	{
+		static inline typename D::Type Convert(const typename S::Type& s)
+		{
+			return D::FromWork(S::ToWork(s));
+		}
+	};
+
+	// Which bulk kernel of the RGBA namespace converts a row from S to D, if any.
+	enum BulkKind { BULK_NONE, BULK_COPY, BULK_SWIZZLE, BULK_FROM, BULK_TO };
+
+	template <class S, class D>
+	struct Bulk
+	{
+		static const BulkKind Kind =
+			std::is_same<S, D>::value ? BULK_COPY :
+			(S::Components && D::Components) ? BULK_SWIZZLE :
+			(S::Components && D::ID == ::RGBA32F) ? BULK_FROM :
+			(S::ID == ::RGBA32F && D::Components) ? BULK_TO : BULK_NONE;
+	};
+
+	// Convert a row of n pixels, one at a time.
+	template <class S, class D, BulkKind K = Bulk<S, D>::Kind>
+	struct RowConverter
+	{
+		static inline void Convert(const typename S::Type *src, typename D::Type *dst, size_t n)
+		{
+			for (size_t i = 0; i < n; i++)
+				dst[i] = Converter<S, D>::Convert(src[i]);
+		}
+	};
+
+	template <class S, class D>
+	struct RowConverter<S, D, BULK_COPY>
+	{
+		static inline void Convert(const typename S::Type *src, typename D::Type *dst, size_t n)
+		{
+			memcpy(dst, src, n * sizeof(typename S::Type));
+		}
+	};
+
+	template <class S, class D>
+	struct RowConverter<S, D, BULK_SWIZZLE>
+	{
+		static inline void Convert(const typename S::Type *src, typename D::Type *dst, size_t n)
+		{
+			RGBA::Swizzle((unsigned char *)dst, D::Components, (const unsigned char *)src, S::Components, S::IsBGR != D::IsBGR, n);
+		}
+	};
+
+	template <class S, class D>
+	struct RowConverter<S, D, BULK_FROM>
+	{
+		static inline void Convert(const typename S::Type *src, Color *dst, size_t n)
+		{
+			if (S::IsBGR)
+				RGBA::FromBGRA(dst, (const unsigned char *)src, S::Components, n);
+			else
+				RGBA::FromRGBA(dst, (const unsigned char *)src, S::Components, n);
+		}
+	};
+
+	template <class S, class D>
+	struct RowConverter<S, D, BULK_TO>
+	{
+		static inline void Convert(const Color *src, typename D::Type *dst, size_t n)
+		{
+			if (D::IsBGR)
+				RGBA::ToBGRA((unsigned char *)dst, D::Components, src, n);
+			else
+				RGBA::ToRGBA((unsigned char *)dst, D::Components, src, n);
+		}
+	};
+
+	template <class S, class D>
+	inline void ConvertRow(const void *src, void *dst, size_t n)
+	{
+		RowConverter<S, D>::Convert((const typename S::Type *)src, (typename D::Type *)dst, n);
+	}
+
+	// Call fn with an instance of the traits of format pf.  Use it once per
+	// operation, outside of the pixel loops.
+	template <class Fn>
+	inline auto Dispatch(PixelFormat pf, Fn fn) -> decltype(fn(RGBA8()))
+	{
+		switch (pf)
+		{
+		case ::RGB8:	return fn(RGB8());
+		case ::BGRA8:	return fn(BGRA8());
+		case ::BGR8:	return fn(BGR8());
+		case ::A8:		return fn(A8());
+		case ::RGBA32F:	return fn(RGBA32F());
+		case ::RGBA16F:	return fn(RGBA16F());
+		default:		return fn(RGBA8());
+		}
+	}
+
+	inline size_t BytesPerPixel(PixelFormat pf)
+	{
+		return Dispatch(pf, [](auto f) { return sizeof(typename decltype(f)::Type); });
+	}
+
+	// Convert a row of n pixels between formats only known at run time.
+	inline void ConvertRow(PixelFormat s, const void *src, PixelFormat d, void *dst, size_t n)
+	{
+		Dispatch(s, [&](auto fs) {
+			Dispatch(d, [&](auto fd) { ConvertRow<decltype(fs), decltype(fd)>(src, dst, n); });
+		});
+	}
+};
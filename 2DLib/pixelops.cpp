@@ -0,0 +1,36 @@
+/* --------------------------------------------------------------------------
+
+pixelops.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Per-pixel loops over a view, split in tiles over the shared thread pool.
+
+-----------------------------------------------------------------------------*/
+
+#include "pixelops.h"
+#include <algorithm>
+
+std::vector<Rect> PixelOps::Tiles(const Size& s, size_t bpp)
+{
+	std::vector<Rect> tiles;
+
+	if (s.W <= 0 || s.H <= 0)
+		return tiles;
+
+	// As many whole rows as fit, or pieces of one row for very wide images.
+	int w = (int)std::min((size_t)s.W, std::max((size_t)1, TILE_BYTES / bpp));
+	int h = (int)std::max((size_t)1, TILE_BYTES / (w * bpp));
+
+	for (int y = 0; y < s.H; y += h)
+	{
+		for (int x = 0; x < s.W; x += w)
+			tiles.push_back(Rect(Point(x, y), Point(std::min(x + w, s.W) - 1, std::min(y + h, s.H) - 1)));
+	}
+
+	return tiles;
+}
@@ -0,0 +1,123 @@
+/* --------------------------------------------------------------------------
+
+pixelops.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Per-pixel loops over a view, split in tiles over the shared thread pool.
+
+Tiles are about TILE_BYTES of pixels, whole rows when they fit, so a tile
+stays in cache while it is worked on.  The format is dispatched once per
+call; the functions get the pixels in their stored type or their work type
+(a Pixel for 8 bit formats, a Color for float ones), so they are usually
+generic lambdas or overloaded functors.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include "bufferview.h"
+#include "threadpool.h"
+
+namespace PixelOps
+{
+	static const size_t TILE_BYTES = 1 << 16;
+
+	// The tiles v is split in, in row-major order.
+	std::vector<Rect> Tiles(const Size& s, size_t bpp);
+
+	// fn(tile, i) for every tile of v, in parallel.  tile is a view of v,
+	// i its index in Tiles().
+	template <class Fn>
+	void ForEachTile(const BufferView& v, Fn fn)
+	{
+		std::vector<Rect> tiles = Tiles(v.GetSize(), Format::BytesPerPixel(v.GetFormat()));
+
+		ThreadPool::Shared().For((int)tiles.size(), [&](int i) { fn(v.Sub(tiles[i]), i); });
+	}
+
+	// fn(p, px) for every pixel of v, px being a reference to the stored
+	// pixel at p.
+	template <class Fn>
+	void ForEachPixel(const BufferView& v, Fn fn)
+	{
+		std::vector<Rect> tiles = Tiles(v.GetSize(), Format::BytesPerPixel(v.GetFormat()));
+
+		Format::Dispatch(v.GetFormat(), [&](auto f) {
+			typedef decltype(f) F;
+
+			ThreadPool::Shared().For((int)tiles.size(), [&](int i) {
+				const Rect &t = tiles[i];
+
+				for (int y = t.top; y <= t.bottom; y++)
+				{
+					typename F::Type *row = v.Row<F>(y);
+
+					for (int x = t.left; x <= t.right; x++)
+						fn(Point(x, y), row[x]);
+				}
+			});
+		});
+	}
+
+	// Replaces every pixel w of v, in its work type, with fn(w).
+	template <class Fn>
+	void Transform(const BufferView& v, Fn fn)
+	{
+		Format::Dispatch(v.GetFormat(), [&](auto f) {
+			typedef decltype(f) F;
+
+			ForEachTile(v, [&](const BufferView& tile, int) {
+				for (int y = 0; y < tile.GetSize().H; y++)
+				{
+					typename F::Type *row = tile.Row<F>(y);
+
+					for (int x = 0; x < tile.GetSize().W; x++)
+						row[x] = F::FromWork(fn(F::ToWork(row[x])));
+				}
+			});
+		});
+	}
+
+	// Folds the pixels of v, in their work type: map(acc, w) adds w to a
+	// tile's accumulator, started from init, and the tiles' accumulators are
+	// then folded with combine(a, b) in tile order, so the result doesn't
+	// depend on the threads.  init must be neutral for combine.
+	template <class T, class Map, class Combine>
+	T Reduce(const BufferView& v, const T& init, Map map, Combine combine)
+	{
+		std::vector<Rect> tiles = Tiles(v.GetSize(), Format::BytesPerPixel(v.GetFormat()));
+		std::vector<T> partial(tiles.size(), init);
+
+		Format::Dispatch(v.GetFormat(), [&](auto f) {
+			typedef decltype(f) F;
+
+			ThreadPool::Shared().For((int)tiles.size(), [&](int i) {
+				const Rect &t = tiles[i];
+				T acc = init;
+
+				for (int y = t.top; y <= t.bottom; y++)
+				{
+					const typename F::Type *row = v.Row<F>(y);
+
+					for (int x = t.left; x <= t.right; x++)
+						map(acc, F::ToWork(row[x]));
+				}
+
+				partial[i] = acc;
+			});
+		});
+
+		T result = init;
+
+		for (const T &p : partial)
+			result = combine(result, p);
+
+		return result;
+	}
+};
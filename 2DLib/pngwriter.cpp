@@ -0,0 +1,293 @@
+/* --------------------------------------------------------------------------
+
+pngwriter.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+PNG encoding over all cores.
+
+-----------------------------------------------------------------------------*/
+
+#include "pngwriter.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+// Filtered bytes per strip, and the deflate window primed from the strip before.
+static const size_t STRIP_SIZE = 1 << 20;
+static const size_t WINDOW = 32768;
+
+struct Strip
+{
+	int y0, y1;
+	std::vector<unsigned char> out;		// Raw deflate data.
+	uLong adler;						// Of the filtered bytes.
+	size_t length;						// Filtered bytes.
+	bool ok;
+};
+
+static void Put32(unsigned char *p, unsigned long v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static bool WriteChunk(FILE *fp, const char *type, const unsigned char *data, size_t n)
+{
+	unsigned char head[8], tail[4];
+
+	Put32(head, (unsigned long)n);
+	memcpy(head + 4, type, 4);
+
+	uLong crc = crc32(0, head + 4, 4);
+
+	if (n)
+		crc = crc32(crc, data, (uInt)n);
+	Put32(tail, crc);
+
+	return fwrite(head, 8, 1, fp) == 1 && (n == 0 || fwrite(data, n, 1, fp) == 1) && fwrite(tail, 4, 1, fp) == 1;
+}
+
+static inline unsigned char Paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+	if (pa <= pb && pa <= pc)
+		return (unsigned char)a;
+
+	return (unsigned char)((pb <= pc) ? b : c);
+}
+
+// Filters n bytes of row into out[1..n] with filter f (not ADAPTIVE), out[0]
+// being the filter type.  prior is the row above, all zeros for the first.
+static void FilterRow(int f, const unsigned char *row, const unsigned char *prior, size_t n, size_t bpp, unsigned char *out)
+{
+	*out++ = (unsigned char)f;
+
+	switch (f)
+	{
+	case PNGWriter::FILTER_SUB:
+		for (size_t i = 0; i < n; i++)
+			out[i] = (unsigned char)(row[i] - ((i >= bpp) ? row[i - bpp] : 0));
+		break;
+
+	case PNGWriter::FILTER_UP:
+		for (size_t i = 0; i < n; i++)
+			out[i] = (unsigned char)(row[i] - prior[i]);
+		break;
+
+	case PNGWriter::FILTER_AVERAGE:
+		for (size_t i = 0; i < n; i++)
+			out[i] = (unsigned char)(row[i] - ((((i >= bpp) ? row[i - bpp] : 0) + prior[i]) >> 1));
+		break;
+
+	case PNGWriter::FILTER_PAETH:
+		for (size_t i = 0; i < n; i++)
+			out[i] = (unsigned char)(row[i] - ((i >= bpp) ? Paeth(row[i - bpp], prior[i], prior[i - bpp]) : prior[i]));
+		break;
+
+	default:
+		memcpy(out, row, n);
+		break;
+	}
+}
+
+// Sum of the filtered bytes taken as signed, libpng's heuristic.
+static size_t Cost(const unsigned char *filtered, size_t n)
+{
+	size_t sum = 0;
+
+	for (size_t i = 0; i < n; i++)
+		sum += (filtered[i] < 128) ? filtered[i] : 256 - filtered[i];
+
+	return sum;
+}
+
+// Deflates data with flush, growing out as needed.
+static bool Deflate(z_stream &z, const unsigned char *data, size_t n, int flush, std::vector<unsigned char> &out)
+{
+	size_t used = 0;
+
+	out.resize(deflateBound(&z, (uLong)n) + 64);
+	z.next_in = (Bytef *)data;
+	z.avail_in = (uInt)n;
+
+	for (;;)
+	{
+		z.next_out = out.data() + used;
+		z.avail_out = (uInt)(out.size() - used);
+
+		int ret = deflate(&z, flush);
+
+		if (ret == Z_STREAM_ERROR)
+			return false;
+
+		used = out.size() - z.avail_out;
+
+		if ((flush == Z_FINISH) ? (ret == Z_STREAM_END) : (z.avail_out != 0))
+			break;
+
+		out.resize(out.size() * 2);
+	}
+
+	out.resize(used);
+	return true;
+}
+
+// Filters and deflates the rows of one strip.  The rows right before it are
+// filtered again to prime the window with what the decoder will have seen.
+static void EncodeStrip(Strip &s, int width, int channels, bool last, const PNGWriter::RowSource &rows, const PNGWriter::Options &opt)
+{
+	size_t bpp = (size_t)channels;
+	size_t n = (size_t)width * bpp;
+
+	int back = (int)std::min<size_t>(s.y0, (WINDOW + n) / (n + 1));
+	int y = s.y0 - back;
+
+	std::vector<unsigned char> filtered(((size_t)(s.y1 - y)) * (n + 1));
+	std::vector<unsigned char> cur(n), prior(n, 0), candidate(n + 1), best(n + 1);
+
+	const unsigned char *prior_row = prior.data();
+
+	if (y > 0)
+		prior_row = rows(y - 1, prior.data());
+
+	unsigned char *dst = filtered.data();
+
+	for (; y < s.y1; y++, dst += n + 1)
+	{
+		const unsigned char *row = rows(y, cur.data());
+
+		if (opt.filter == PNGWriter::FILTER_ADAPTIVE)
+		{
+			size_t best_cost = (size_t)-1;
+
+			for (int f = PNGWriter::FILTER_NONE; f <= PNGWriter::FILTER_PAETH; f++)
+			{
+				FilterRow(f, row, prior_row, n, bpp, candidate.data());
+				size_t c = Cost(candidate.data() + 1, n);
+
+				if (c < best_cost)
+				{
+					best_cost = c;
+					best.swap(candidate);
+				}
+			}
+
+			memcpy(dst, best.data(), n + 1);
+		}
+		else
+			FilterRow(opt.filter, row, prior_row, n, bpp, dst);
+
+		// The row stays valid for the next one if it is not our scratch.
+		if (row == cur.data())
+		{
+			cur.swap(prior);
+			prior_row = prior.data();
+		}
+		else
+			prior_row = row;
+	}
+
+	size_t dict = (size_t)back * (n + 1);
+	const unsigned char *data = filtered.data() + dict;
+
+	s.length = filtered.size() - dict;
+	s.adler = adler32(adler32(0, nullptr, 0), data, (uInt)s.length);
+
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+
+	if (deflateInit2(&z, opt.level, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		return;
+
+	size_t window = std::min(dict, WINDOW);
+	s.ok = (window == 0 || deflateSetDictionary(&z, data - window, (uInt)window) == Z_OK)
+		&& Deflate(z, data, s.length, (last) ? Z_FINISH : Z_SYNC_FLUSH, s.out);
+
+	deflateEnd(&z);
+}
+
+bool PNGWriter::Write(FILE *fp, int width, int height, int channels, const RowSource &rows, const Options &opt)
+{
+	static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+	if (width <= 0 || height <= 0 || (channels != 3 && channels != 4))
+		return false;
+
+	unsigned char ihdr[13];
+	Put32(ihdr, width);
+	Put32(ihdr + 4, height);
+	ihdr[8] = 8;
+	ihdr[9] = (channels == 4) ? 6 : 2;
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+	if (fwrite(signature, 8, 1, fp) != 1 || !WriteChunk(fp, "IHDR", ihdr, 13))
+		return false;
+
+	size_t row_size = (size_t)width * channels + 1;
+	int rows_per_strip = (int)std::max<size_t>(1, STRIP_SIZE / row_size);
+	int strips = (height + rows_per_strip - 1) / rows_per_strip;
+
+	// zlib header for the stream the strips make up, with the level hint.
+	int flevel = (opt.level < 2) ? 0 : (opt.level < 6) ? 1 : (opt.level == 6) ? 2 : 3;
+	unsigned char zheader[2] = { 0x78, (unsigned char)(flevel << 6) };
+	zheader[1] += (unsigned char)(31 - ((zheader[0] << 8) | zheader[1]) % 31);
+
+	uLong adler = adler32(0, nullptr, 0);
+
+	// Strips are encoded a few per thread at a time so the compressed data
+	// waiting to be written stays small.
+	int wave = ThreadPool::Shared().GetSize() * 2;
+
+	for (int first = 0; first < strips; first += wave)
+	{
+		std::vector<Strip> batch(std::min(wave, strips - first));
+
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			batch[i].y0 = (first + (int)i) * rows_per_strip;
+			batch[i].y1 = std::min(height, batch[i].y0 + rows_per_strip);
+			batch[i].ok = false;
+		}
+
+		ThreadPool::Shared().For((int)batch.size(), [&](int i) {
+			EncodeStrip(batch[i], width, channels, first + i == strips - 1, rows, opt);
+		});
+
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			Strip &s = batch[i];
+
+			if (!s.ok)
+				return false;
+
+			adler = adler32_combine(adler, s.adler, (z_off_t)s.length);
+
+			if (first + (int)i == 0)
+				s.out.insert(s.out.begin(), zheader, zheader + 2);
+
+			if (first + (int)i == strips - 1)
+			{
+				unsigned char trailer[4];
+				Put32(trailer, adler);
+				s.out.insert(s.out.end(), trailer, trailer + 4);
+			}
+
+			if (!s.out.empty() && !WriteChunk(fp, "IDAT", s.out.data(), s.out.size()))
+				return false;
+		}
+	}
+
+	return WriteChunk(fp, "IEND", nullptr, 0);
+}
@@ -0,0 +1,46 @@
+/* --------------------------------------------------------------------------
+
+pngwriter.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+PNG encoding over all cores.  We write the chunks ourselves and use zlib
+directly: the image is cut in strips of rows that are filtered and deflated
+in parallel, each strip primed with the 32K of filtered data before it.
+All strips but the last end with a sync flush so the raw deflate streams
+concatenate into one, and the strip checksums are merged with
+adler32_combine().  Each strip goes into its own IDAT chunk.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <cstdio>
+#include <functional>
+
+namespace PNGWriter
+{
+	// Row filters.  ADAPTIVE picks, per row, the filter giving the smallest sum
+	// of absolute differences, like libpng does.
+	enum Filter { FILTER_NONE, FILTER_SUB, FILTER_UP, FILTER_AVERAGE, FILTER_PAETH, FILTER_ADAPTIVE };
+
+	struct Options
+	{
+		int level;		// zlib level, 0 (store) to 9 (smallest).
+		Filter filter;
+
+		Options(int l = 6, Filter f = FILTER_ADAPTIVE) : level(l), filter(f) { }
+	};
+
+	// Gives row y as width * channels bytes, R G B (A).  Returns scratch once
+	// filled, or the row itself if it is already stored that way.  Called from
+	// several threads at once.
+	typedef std::function<const unsigned char *(int y, unsigned char *scratch)> RowSource;
+
+	// Writes an 8 bit RGB (3 channels) or RGBA (4 channels) PNG to fp.
+	bool Write(FILE *fp, int width, int height, int channels, const RowSource &rows, const Options &opt);
+};
@@ -0,0 +1,259 @@
+/* --------------------------------------------------------------------------
+
+regions.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Finding every connected region of content in a buffer.
+
+-----------------------------------------------------------------------------*/
+
+#include "regions.h"
+#include "threadpool.h"
+#include <algorithm>
+
+// Minimum rows per band.
+static const int BAND = 32;
+
+struct Run
+{
+	int x0, x1, y;
+};
+
+struct Band
+{
+	std::vector<Run> runs;
+	std::vector<size_t> rows;	// Index of the first run of each row, and the end.
+	std::vector<int> parent;
+};
+
+static int Root(std::vector<int> &parent, int i)
+{
+	while (parent[i] != i)
+	{
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+
+	return i;
+}
+
+static bool Join(std::vector<int> &parent, int a, int b)
+{
+	a = Root(parent, a);
+	b = Root(parent, b);
+
+	if (a == b)
+		return false;
+
+	if (a < b)
+		parent[b] = a;
+	else
+		parent[a] = b;
+
+	return true;
+}
+
+// Joins the runs [a, a_end) of a row with the runs [b, b_end) of the row
+// below, both sorted left to right.  offset_a / offset_b turn the indices
+// into parent indices.
+static void Connect(const Run *a, const Run *a_end, int offset_a, const Run *b, const Run *b_end, int offset_b, int reach, std::vector<int> &parent)
+{
+	const Run *a_first = a, *b_first = b;
+
+	while (a != a_end && b != b_end)
+	{
+		if (a->x0 <= b->x1 + reach && b->x0 <= a->x1 + reach)
+			Join(parent, offset_a + (int)(a - a_first), offset_b + (int)(b - b_first));
+
+		// Step past whichever run ends first.
+		if (a->x1 < b->x1)
+			a++;
+		else
+			b++;
+	}
+}
+
+// Merges regions whose rects have at most d pixels between them, until none do.
+static void MergeClose(std::vector<Regions::Region> &regions, int d)
+{
+	d++;
+
+	for (;;)
+	{
+		std::sort(regions.begin(), regions.end(), [](const Regions::Region &a, const Regions::Region &b) { return a.rect.left < b.rect.left; });
+
+		std::vector<int> parent(regions.size());
+
+		for (size_t i = 0; i < regions.size(); i++)
+			parent[i] = (int)i;
+
+		bool merged = false;
+
+		for (size_t i = 0; i < regions.size(); i++)
+		{
+			const Rect &a = regions[i].rect;
+
+			for (size_t j = i + 1; j < regions.size() && regions[j].rect.left <= a.right + d; j++)
+			{
+				const Rect &b = regions[j].rect;
+
+				if (b.top <= a.bottom + d && a.top <= b.bottom + d)
+					merged |= Join(parent, (int)i, (int)j);
+			}
+		}
+
+		if (!merged)
+			return;
+
+		std::vector<Regions::Region> out;
+		std::vector<int> slot(regions.size(), -1);
+
+		for (size_t i = 0; i < regions.size(); i++)
+		{
+			int r = Root(parent, (int)i);
+
+			if (slot[r] < 0)
+			{
+				slot[r] = (int)out.size();
+				out.push_back(regions[i]);
+				continue;
+			}
+
+			Regions::Region &o = out[slot[r]];
+			const Rect &b = regions[i].rect;
+
+			o.rect.left = std::min(o.rect.left, b.left);
+			o.rect.top = std::min(o.rect.top, b.top);
+			o.rect.right = std::max(o.rect.right, b.right);
+			o.rect.bottom = std::max(o.rect.bottom, b.bottom);
+			o.area += regions[i].area;
+		}
+
+		regions.swap(out);
+	}
+}
+
+std::vector<Regions::Region> Regions::Find(const unsigned char *bits, const Size &size, size_t stride, PixelFormat pf, const Mask &m, const Options &opt)
+{
+	std::vector<Region> regions;
+
+	if (size.W <= 0 || size.H <= 0)
+		return regions;
+
+	const int reach = (opt.diagonal) ? 1 : 0;
+	const int rows_per_band = std::max(BAND, (size.H + ThreadPool::Shared().GetSize() * 4 - 1) / (ThreadPool::Shared().GetSize() * 4));
+	const int count = (size.H + rows_per_band - 1) / rows_per_band;
+
+	std::vector<Band> bands(count);
+
+	// Runs, and joins within each band.
+	Format::Dispatch(pf, [&](auto f) {
+		typedef decltype(f) F;
+		const Format::MaskTest<F> test(m);
+
+		ThreadPool::Shared().For(count, [&](int k) {
+			Band &band = bands[k];
+			int y0 = k * rows_per_band, y1 = std::min(size.H, y0 + rows_per_band);
+
+			for (int y = y0; y < y1; y++)
+			{
+				const auto *row = (const typename F::Type *)(bits + (size_t)y * stride);
+				band.rows.push_back(band.runs.size());
+
+				for (int x = 0; x < size.W; x++)
+				{
+					if (!test(row[x]))
+						continue;
+
+					Run r = { x, x, y };
+
+					while (r.x1 + 1 < size.W && test(row[r.x1 + 1]))
+						r.x1++;
+
+					band.runs.push_back(r);
+					x = r.x1;
+				}
+			}
+
+			band.rows.push_back(band.runs.size());
+			band.parent.resize(band.runs.size());
+
+			for (size_t i = 0; i < band.parent.size(); i++)
+				band.parent[i] = (int)i;
+
+			const Run *runs = band.runs.data();
+
+			for (size_t r = 1; r + 1 < band.rows.size(); r++)
+			{
+				Connect(runs + band.rows[r - 1], runs + band.rows[r], (int)band.rows[r - 1],
+					runs + band.rows[r], runs + band.rows[r + 1], (int)band.rows[r], reach, band.parent);
+			}
+		});
+	});
+
+	// One union-find over all bands, then the rows where bands meet.
+	std::vector<int> parent;
+	std::vector<int> offsets;
+
+	for (Band &band : bands)
+	{
+		int offset = (int)parent.size();
+		offsets.push_back(offset);
+
+		for (int p : band.parent)
+			parent.push_back(p + offset);
+	}
+
+	for (int k = 1; k < count; k++)
+	{
+		const Band &above = bands[k - 1], &below = bands[k];
+		const Run *a = above.runs.data(), *b = below.runs.data();
+		size_t last = above.rows.size() - 2;
+
+		Connect(a + above.rows[last], a + above.rows[last + 1], offsets[k - 1] + (int)above.rows[last],
+			b + below.rows[0], b + below.rows[1], offsets[k], reach, parent);
+	}
+
+	// Rects and areas per root.
+	std::vector<int> slot(parent.size(), -1);
+
+	for (int k = 0; k < count; k++)
+	{
+		for (size_t i = 0; i < bands[k].runs.size(); i++)
+		{
+			const Run &r = bands[k].runs[i];
+			int root = Root(parent, offsets[k] + (int)i);
+
+			if (slot[root] < 0)
+			{
+				slot[root] = (int)regions.size();
+
+				Region region = { Rect(Point(r.x0, r.y), Point(r.x1, r.y)), 0 };
+				regions.push_back(region);
+			}
+
+			Region &region = regions[slot[root]];
+
+			region.rect.left = std::min(region.rect.left, r.x0);
+			region.rect.right = std::max(region.rect.right, r.x1);
+			region.rect.bottom = std::max(region.rect.bottom, r.y);
+			region.area += (unsigned int)(r.x1 - r.x0 + 1);
+		}
+	}
+
+	if (opt.merge_distance >= 0)
+		MergeClose(regions, opt.merge_distance);
+
+	regions.erase(std::remove_if(regions.begin(), regions.end(), [&](const Region &r) { return r.area < opt.min_area; }), regions.end());
+
+	std::sort(regions.begin(), regions.end(), [](const Region &a, const Region &b) {
+		return (a.rect.top != b.rect.top) ? a.rect.top < b.rect.top : a.rect.left < b.rect.left;
+	});
+
+	return regions;
+}
@@ -0,0 +1,46 @@
+/* --------------------------------------------------------------------------
+
+regions.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Finding every connected region of content in a buffer, e.g. all sprites on
+a sheet, in one pass.
+
+Rows are cut in runs of content and runs touching the runs of the row above
+are joined with a union-find.  Horizontal bands are done in parallel, then
+the rows where bands meet are joined.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include "mask.h"
+#include "rect.h"
+
+namespace Regions
+{
+	struct Options
+	{
+		bool diagonal;			// Pixels touching by a corner are connected.
+		int merge_distance;		// Merge regions with at most this many pixels between their rects, -1 for never.
+		unsigned int min_area;	// Drop regions with fewer content pixels.
+
+		Options(bool d = true, int merge = -1, unsigned int area = 0) : diagonal(d), merge_distance(merge), min_area(area) { }
+	};
+
+	struct Region
+	{
+		Rect rect;
+		unsigned int area;		// Content pixels.
+	};
+
+	// Regions of what m counts as content in an image of format pf with rows
+	// stride bytes apart, top to bottom then left to right.
+	std::vector<Region> Find(const unsigned char *bits, const Size &size, size_t stride, PixelFormat pf, const Mask &m, const Options &opt = Options());
+};
@@ -0,0 +1,317 @@
+/* --------------------------------------------------------------------------
+
+resample.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Resizing images with separable filters.
+
+-----------------------------------------------------------------------------*/
+
+#include "resample.h"
+#include "bufferview.h"
+#include "composite.h"
+#include "simd.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const float PI = 3.14159265358979f;
+
+// Rows per band in both passes.
+static const int BAND_ROWS = 16;
+
+static float Support(Resample::Filter f)
+{
+	switch (f)
+	{
+	case Resample::BOX:			return 0.5f;
+	case Resample::BILINEAR:	return 1.f;
+	case Resample::BICUBIC:		return 2.f;
+	default:					return 3.f;		// Lanczos and Kaiser.
+	}
+}
+
+static float Sinc(float x)
+{
+	if (x == 0.f)
+		return 1.f;
+
+	x *= PI;
+	return std::sin(x) / x;
+}
+
+// Modified Bessel function of the first kind, order 0, by its series.
+static float BesselI0(float x)
+{
+	float sum = 1.f, term = 1.f, q = x * x / 4.f;
+
+	for (int k = 1; k < 32 && term > sum * 1e-8f; k++)
+	{
+		term *= q / (float)(k * k);
+		sum += term;
+	}
+
+	return sum;
+}
+
+static float Weight(Resample::Filter f, float x)
+{
+	x = std::fabs(x);
+
+	switch (f)
+	{
+	case Resample::BOX:
+		return (x <= 0.5f) ? 1.f : 0.f;
+	case Resample::BILINEAR:
+		return (x < 1.f) ? 1.f - x : 0.f;
+	case Resample::BICUBIC:
+		// Catmull-Rom, B = 0, C = 1/2.
+		if (x < 1.f)
+			return 1.5f * x * x * x - 2.5f * x * x + 1.f;
+		if (x < 2.f)
+			return -0.5f * x * x * x + 2.5f * x * x - 4.f * x + 2.f;
+		return 0.f;
+	case Resample::KAISER:
+	{
+		static const float alpha = 4.f, i0_alpha = BesselI0(alpha);
+
+		if (x >= 3.f)
+			return 0.f;
+
+		float t = x / 3.f;
+		return Sinc(x) * BesselI0(alpha * std::sqrt(1.f - t * t)) / i0_alpha;
+	}
+	default:
+		return (x < 3.f) ? Sinc(x) * Sinc(x / 3.f) : 0.f;
+	}
+}
+
+Resample::Table::Table(int n_in, int n_out, Filter f)
+	: taps(0)
+{
+	// When shrinking, the filter is stretched to cover all the inputs of an output.
+	float scale = (float)n_out / n_in;
+	float stretch = std::max(1.f, 1.f / scale);
+	float support = Support(f) * stretch;
+
+	std::vector<std::vector<float>> rows(n_out);
+	start.resize(n_out);
+
+	for (int i = 0; i < n_out; i++)
+	{
+		float center = (i + 0.5f) / scale;
+		int lo = (int)std::floor(center - support), hi = (int)std::ceil(center + support);
+
+		// Weights of the clamped inputs.
+		int first = std::max(0, std::min(lo, n_in - 1)), last = std::max(0, std::min(hi, n_in - 1));
+		std::vector<float> &w = rows[i];
+		w.assign(last - first + 1, 0.f);
+
+		float total = 0.f;
+
+		for (int j = lo; j <= hi; j++)
+		{
+			float k = Weight(f, (j + 0.5f - center) / stretch);
+
+			w[std::max(0, std::min(j, n_in - 1)) - first] += k;
+			total += k;
+		}
+
+		if (total == 0.f)
+		{
+			// A box narrower than a pixel can miss every sample: take the nearest.
+			int nearest = std::max(0, std::min((int)center, n_in - 1));
+			w[nearest - first] = total = 1.f;
+		}
+
+		for (float &k : w)
+			k /= total;
+
+		// Drop the zeros at both ends.
+		while (w.size() > 1 && w.back() == 0.f)
+			w.pop_back();
+
+		while (w.size() > 1 && w.front() == 0.f)
+		{
+			w.erase(w.begin());
+			first++;
+		}
+
+		start[i] = first;
+		taps = std::max(taps, (int)w.size());
+	}
+
+	// The same number of taps everywhere, moving windows back from the end.
+	taps = std::min(taps, n_in);
+	weights.assign((size_t)n_out * taps, 0.f);
+
+	for (int i = 0; i < n_out; i++)
+	{
+		int s = std::min(start[i], n_in - taps);
+
+		for (size_t k = 0; k < rows[i].size(); k++)
+			weights[(size_t)i * taps + (start[i] - s) + k] = rows[i][k];
+
+		start[i] = s;
+	}
+}
+
+#ifndef SIMD_X86
+
+// out[i] = sum of the table's weights times row, one pixel at a time.
+static void FilterRowScalar(Color *out, const Color *row, const Resample::Table& t, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		const Color *in = row + t.start[i];
+		const float *w = &t.weights[(size_t)i * t.taps];
+		Color c(0.f, 0.f, 0.f, 0.f);
+
+		for (int k = 0; k < t.taps; k++)
+			c += in[k] * w[k];
+
+		out[i] = c;
+	}
+}
+
+#endif
+
+// out += w * in over n floats.
+static void AddScaledScalar(float *out, const float *in, float w, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		out[i] += in[i] * w;
+}
+
+#ifdef SIMD_X86
+
+SIMD_SSE2 static void FilterRowSSE2(Color *out, const Color *row, const Resample::Table& t, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		const float *in = (const float *)(row + t.start[i]);
+		const float *w = &t.weights[(size_t)i * t.taps];
+		__m128 c = _mm_setzero_ps();
+
+		for (int k = 0; k < t.taps; k++)
+			c = _mm_add_ps(c, _mm_mul_ps(_mm_loadu_ps(in + k * 4), _mm_set1_ps(w[k])));
+
+		_mm_storeu_ps((float *)(out + i), c);
+	}
+}
+
+SIMD_SSE2 static void AddScaledSSE2(float *out, const float *in, float w, size_t n)
+{
+	const __m128 k = _mm_set1_ps(w);
+	size_t i = 0;
+
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), k)));
+
+	AddScaledScalar(out + i, in + i, w, n - i);
+}
+
+SIMD_AVX2 static void AddScaledAVX2(float *out, const float *in, float w, size_t n)
+{
+	const __m256 k = _mm256_set1_ps(w);
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), k)));
+
+	AddScaledScalar(out + i, in + i, w, n - i);
+}
+
+#endif
+
+static void FilterRow(Color *out, const Color *row, const Resample::Table& t, int n)
+{
+#ifdef SIMD_X86
+	FilterRowSSE2(out, row, t, n);
+#else
+	FilterRowScalar(out, row, t, n);
+#endif
+}
+
+static void AddScaled(float *out, const float *in, float w, size_t n)
+{
+#ifdef SIMD_X86
+	static void (* const fn)(float *, const float *, float, size_t) = SIMD::HasAVX2() ? &AddScaledAVX2 : &AddScaledSSE2;
+	fn(out, in, w, n);
+#else
+	AddScaledScalar(out, in, w, n);
+#endif
+}
+
+void Resample::Resize(const BufferView& dst, const BufferView& src, const Options& opt)
+{
+	if (dst.IsEmpty() || src.IsEmpty())
+		return;
+
+	int sw = src.GetSize().W, sh = src.GetSize().H;
+	int dw = dst.GetSize().W, dh = dst.GetSize().H;
+	PixelFormat sf = src.GetFormat(), df = dst.GetFormat();
+
+	bool has_alpha = sf != A8 && Format::Dispatch(sf, [](auto f) { return decltype(f)::HasAlpha; });
+	bool convert = has_alpha && !opt.premultiplied;
+
+	Table horz(sw, dw, opt.filter), vert(sh, dh, opt.filter);
+
+	// Horizontal pass: only the source rows the vertical pass reads.
+	int first = vert.start.front(), last = vert.start.back() + vert.taps - 1;
+	std::vector<Color> tmp((size_t)dw * (last - first + 1));
+
+	int bands = (last - first + 1 + BAND_ROWS - 1) / BAND_ROWS;
+
+	ThreadPool::Shared().For(bands, [&](int b) {
+		std::vector<Color> row(sw);
+
+		for (int y = first + b * BAND_ROWS; y <= std::min(last, first + (b + 1) * BAND_ROWS - 1); y++)
+		{
+			Format::ConvertRow(sf, src.Row(y), RGBA32F, row.data(), sw);
+
+			if (convert)
+				Composite::Premultiply(row.data(), sw);
+
+			FilterRow(&tmp[(size_t)(y - first) * dw], row.data(), horz, dw);
+		}
+	});
+
+	// Vertical pass, a whole output row at a time.
+	bands = (dh + BAND_ROWS - 1) / BAND_ROWS;
+
+	ThreadPool::Shared().For(bands, [&](int b) {
+		std::vector<Color> row(dw);
+
+		for (int y = b * BAND_ROWS; y < std::min(dh, (b + 1) * BAND_ROWS); y++)
+		{
+			std::fill(row.begin(), row.end(), Color(0.f, 0.f, 0.f, 0.f));
+
+			const float *w = &vert.weights[(size_t)y * vert.taps];
+
+			for (int k = 0; k < vert.taps; k++)
+			{
+				if (w[k] != 0.f)
+					AddScaled((float *)row.data(), (const float *)&tmp[(size_t)(vert.start[y] + k - first) * dw], w[k], (size_t)dw * 4);
+			}
+
+			// Overshoot from negative lobes must not leave alpha outside [0, 1].
+			if (has_alpha)
+			{
+				for (Color &c : row)
+					c.a = std::min(std::max(c.a, 0.f), 1.f);
+			}
+
+			if (convert)
+				Composite::Unpremultiply(row.data(), dw);
+
+			Format::ConvertRow(RGBA32F, row.data(), df, dst.Row(y), dw);
+		}
+	});
+}
@@ -0,0 +1,65 @@
+/* --------------------------------------------------------------------------
+
+resample.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Resizing images with separable filters.
+
+The weights of each output column and row are computed once into tables.
+Rows are filtered horizontally into a float image, then the columns
+vertically, both in bands on the shared thread pool: one pixel per SSE2
+register horizontally, whole rows of floats at a time vertically.
+
+Filtering is done on premultiplied colors so transparent pixels don't
+bleed their color into their neighbours.  Straight alpha is premultiplied
+on the way in and divided back on the way out.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+#include "color.h"
+
+class BufferView;
+
+namespace Resample
+{
+	enum Filter
+	{
+		BOX,			// Average of the covered pixels.  Fast, blocky when enlarging.
+		BILINEAR,		// Triangle filter.
+		BICUBIC,		// Catmull-Rom: sharp, slight ringing.
+		LANCZOS3,		// Windowed sinc over 3 lobes: sharpest, for thumbnails.
+		KAISER			// Kaiser windowed sinc (width 3, alpha 4): less ringing, for mipmaps.
+	};
+
+	struct Options
+	{
+		Filter filter;
+		bool premultiplied;		// The pixels are already premultiplied, and stay so.
+
+		Options(Filter f = LANCZOS3, bool p = false) : filter(f), premultiplied(p) { }
+	};
+
+	// The weights giving each of n_out samples from n_in ones: output i is the
+	// sum of weights[i * taps + k] * input[start[i] + k] for k < taps.  Edges
+	// are clamped, and every output's weights add up to 1.
+	struct Table
+	{
+		int taps;
+		std::vector<int> start;
+		std::vector<float> weights;
+
+		Table(int n_in, int n_out, Filter f);
+	};
+
+	// Scales all of src to fill dst.  Formats can differ.  dst may be in
+	// the same buffer as src: src is read in full before dst is written.
+	void Resize(const BufferView& dst, const BufferView& src, const Options& opt = Options());
+};
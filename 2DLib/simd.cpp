@@ -0,0 +1,51 @@
+/* --------------------------------------------------------------------------
+
+simd.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+What we need to write SSE2 / AVX2 kernels and pick them at run time.
+
+-----------------------------------------------------------------------------*/
+
+#include "simd.h"
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static bool DetectAVX2()
+{
+#if defined(SIMD_X86) && defined(_MSC_VER)
+	int info[4];
+
+	__cpuid(info, 0);
+
+	if (info[0] < 7)
+		return false;
+
+	// The OS must save the YMM registers (OSXSAVE, then XCR0 bits 1 and 2).
+	__cpuid(info, 1);
+
+	if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(SIMD_X86)
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#else
+	return false;
+#endif
+}
+
+bool SIMD::HasAVX2()
+{
+	static const bool has = DetectAVX2();
+	return has;
+}
@@ -0,0 +1,39 @@
+/* --------------------------------------------------------------------------
+
+simd.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+What we need to write SSE2 / AVX2 kernels and pick them at run time.
+
+SIMD_X86 is defined when the intrinsics are available.  Functions using
+AVX2 intrinsics must be marked SIMD_AVX2 (gcc and clang compile them
+without -mavx2 that way) and only be called when SIMD::HasAVX2() is true.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#define SIMD_SSE2
+#define SIMD_AVX2
+#else
+#define SIMD_SSE2 __attribute__((target("sse2")))
+#define SIMD_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace SIMD
+{
+	// CPU features, detected once.
+	bool HasAVX2();
+};
@@ -0,0 +1,311 @@
+/* --------------------------------------------------------------------------
+
+stats.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Image statistics gathered in one pass.
+
+-----------------------------------------------------------------------------*/
+
+#include "stats.h"
+#include "bufferview.h"
+#include "simd.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+// Bands have at least this many pixels.
+static const size_t BAND_PIXELS = 1 << 15;
+
+// What a band adds up.  8 bit sources are counted in integers, float ones in
+// doubles.
+struct Partial
+{
+	unsigned long long packed[4];
+	double sum[4];
+	float min[4], max[4];
+	unsigned int histogram[4][256];
+	unsigned long long count, covered, opaque;
+	int left, top, right, bottom;		// Bounds of the covered pixels, empty when left > right.
+
+	Partial()
+	{
+		memset(this, 0, sizeof(*this));
+
+		for (int c = 0; c < 4; c++)
+		{
+			min[c] = FLT_MAX;
+			max[c] = -FLT_MAX;
+		}
+
+		left = top = INT_MAX;
+		right = bottom = INT_MIN;
+	}
+
+	void Cover(int x0, int x1, int y)
+	{
+		left = std::min(left, x0);
+		right = std::max(right, x1);
+		top = std::min(top, y);
+		bottom = std::max(bottom, y);
+	}
+
+	void Add(const Partial& p)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			packed[c] += p.packed[c];
+			sum[c] += p.sum[c];
+			min[c] = std::min(min[c], p.min[c]);
+			max[c] = std::max(max[c], p.max[c]);
+
+			for (int i = 0; i < 256; i++)
+				histogram[c][i] += p.histogram[c][i];
+		}
+
+		count += p.count;
+		covered += p.covered;
+		opaque += p.opaque;
+
+		left = std::min(left, p.left);
+		top = std::min(top, p.top);
+		right = std::max(right, p.right);
+		bottom = std::max(bottom, p.bottom);
+	}
+};
+
+// A row of 8 bit pixels.  Min and max are kept in 0..255 until the end.
+static void AddRow(Partial& p, const Pixel *px, int n, int y)
+{
+	unsigned long long sum[4] = { 0, 0, 0, 0 };
+	int lo[4] = { 255, 255, 255, 255 }, hi[4] = { 0, 0, 0, 0 };
+	int first = -1, last = -1;
+
+	for (int x = 0; x < n; x++)
+	{
+		const unsigned char *v = &px[x].r;
+
+		for (int c = 0; c < 4; c++)
+		{
+			sum[c] += v[c];
+			lo[c] = std::min(lo[c], (int)v[c]);
+			hi[c] = std::max(hi[c], (int)v[c]);
+			p.histogram[c][v[c]]++;
+		}
+
+		if (v[3])
+		{
+			if (first < 0)
+				first = x;
+
+			last = x;
+			p.covered++;
+			p.opaque += (v[3] == 255) ? 1 : 0;
+		}
+	}
+
+	for (int c = 0; c < 4; c++)
+	{
+		p.packed[c] += sum[c];
+		p.min[c] = std::min(p.min[c], lo[c] / 255.f);
+		p.max[c] = std::max(p.max[c], hi[c] / 255.f);
+	}
+
+	p.count += n;
+
+	if (first >= 0)
+		p.Cover(first, last, y);
+}
+
+#ifndef SIMD_X86
+
+static void AddRowScalar(Partial& p, const Color *px, int n, int y)
+{
+	int first = -1, last = -1;
+
+	for (int x = 0; x < n; x++)
+	{
+		const Color &v = px[x];
+
+		for (int c = 0; c < 4; c++)
+		{
+			p.sum[c] += v[c];
+			p.min[c] = std::min(p.min[c], v[c]);
+			p.max[c] = std::max(p.max[c], v[c]);
+			p.histogram[c][RGBA::PackChannel(v[c])]++;
+		}
+
+		if (v.a > 0.f)
+		{
+			if (first < 0)
+				first = x;
+
+			last = x;
+			p.covered++;
+			p.opaque += (v.a >= 1.f) ? 1 : 0;
+		}
+	}
+
+	p.count += n;
+
+	if (first >= 0)
+		p.Cover(first, last, y);
+}
+
+#endif
+
+#ifdef SIMD_X86
+
+// One pixel per register: sums in two double registers, min and max in
+// place, histogram bins from the rounded channels.
+SIMD_SSE2 static void AddRowSSE2(Partial& p, const Color *px, int n, int y)
+{
+	__m128d sum_rg = _mm_loadu_pd(&p.sum[0]), sum_ba = _mm_loadu_pd(&p.sum[2]);
+	__m128 lo = _mm_loadu_ps(p.min), hi = _mm_loadu_ps(p.max);
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f), scale = _mm_set1_ps(255.f), half = _mm_set1_ps(0.5f);
+	int first = -1, last = -1;
+
+	for (int x = 0; x < n; x++)
+	{
+		__m128 v = _mm_loadu_ps((const float *)(px + x));
+
+		sum_rg = _mm_add_pd(sum_rg, _mm_cvtps_pd(v));
+		sum_ba = _mm_add_pd(sum_ba, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+		lo = _mm_min_ps(lo, v);
+		hi = _mm_max_ps(hi, v);
+
+		// Same rounding as RGBA::PackChannel().
+		__m128i q = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(v, zero), one), scale), half));
+		int bins[4];
+		_mm_storeu_si128((__m128i *)bins, q);
+
+		for (int c = 0; c < 4; c++)
+			p.histogram[c][bins[c]]++;
+
+		float a = px[x].a;
+
+		if (a > 0.f)
+		{
+			if (first < 0)
+				first = x;
+
+			last = x;
+			p.covered++;
+			p.opaque += (a >= 1.f) ? 1 : 0;
+		}
+	}
+
+	_mm_storeu_pd(&p.sum[0], sum_rg);
+	_mm_storeu_pd(&p.sum[2], sum_ba);
+	_mm_storeu_ps(p.min, lo);
+	_mm_storeu_ps(p.max, hi);
+
+	p.count += n;
+
+	if (first >= 0)
+		p.Cover(first, last, y);
+}
+
+#endif
+
+static void AddRow(Partial& p, const Color *px, int n, int y)
+{
+#ifdef SIMD_X86
+	AddRowSSE2(p, px, n, y);
+#else
+	AddRowScalar(p, px, n, y);
+#endif
+}
+
+// Adds up partials [begin, end) pairwise.
+static Partial Combine(std::vector<Partial>& partials, size_t begin, size_t end)
+{
+	if (end - begin == 1)
+		return partials[begin];
+
+	size_t mid = begin + (end - begin) / 2;
+	Partial p = Combine(partials, begin, mid);
+	p.Add(Combine(partials, mid, end));
+
+	return p;
+}
+
+Stats::Result::Result()
+	: count(0)
+	, mean(RGBA::NoAlpha)
+	, min(RGBA::NoAlpha)
+	, max(RGBA::NoAlpha)
+	, covered(0)
+	, opaque(0)
+	, bounds(Point(0, 0), Size(0, 0))
+{
+	memset(histogram, 0, sizeof(histogram));
+}
+
+Stats::Result Stats::Compute(const BufferView& v)
+{
+	Result r;
+	Size s = v.GetSize();
+
+	if (v.IsEmpty())
+		return r;
+
+	PixelFormat pf = v.GetFormat();
+	bool is_float = Format::Dispatch(pf, [](auto f) { return decltype(f)::IsFloat; });
+
+	int rows = (int)std::max((size_t)1, BAND_PIXELS / s.W);
+	int bands = (s.H + rows - 1) / rows;
+	std::vector<Partial> partials(bands);
+
+	ThreadPool::Shared().For(bands, [&](int i) {
+		Partial &p = partials[i];
+		std::vector<Pixel> pixels((is_float || pf == RGBA8) ? 0 : s.W);
+		std::vector<Color> colors((!is_float || pf == RGBA32F) ? 0 : s.W);
+
+		for (int y = i * rows; y < std::min(s.H, (i + 1) * rows); y++)
+		{
+			if (pf == RGBA8)
+				AddRow(p, v.Row<Format::RGBA8>(y), s.W, y);
+			else if (pf == RGBA32F)
+				AddRow(p, v.Row<Format::RGBA32F>(y), s.W, y);
+			else if (is_float)
+			{
+				Format::ConvertRow(pf, v.Row(y), RGBA32F, colors.data(), s.W);
+				AddRow(p, colors.data(), s.W, y);
+			}
+			else
+			{
+				Format::ConvertRow(pf, v.Row(y), RGBA8, pixels.data(), s.W);
+				AddRow(p, pixels.data(), s.W, y);
+			}
+		}
+	});
+
+	Partial total = Combine(partials, 0, partials.size());
+
+	r.count = total.count;
+
+	for (int c = 0; c < 4; c++)
+	{
+		r.mean[c] = (float)((total.sum[c] + total.packed[c] / 255.0) / total.count);
+		r.min[c] = total.min[c];
+		r.max[c] = total.max[c];
+	}
+
+	memcpy(r.histogram, total.histogram, sizeof(r.histogram));
+	r.covered = total.covered;
+	r.opaque = total.opaque;
+
+	if (total.left <= total.right)
+		r.bounds = Rect(Point(total.left, total.top), Point(total.right, total.bottom));
+
+	return r;
+}
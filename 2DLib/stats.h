@@ -0,0 +1,46 @@
+/* --------------------------------------------------------------------------
+
+stats.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Image statistics gathered in one pass: mean, min and max, 8 bit histograms,
+alpha coverage and the bounds of what isn't transparent.
+
+Bands of rows are summed on the shared pool, 8 bit channels in integers and
+float ones in doubles, then the bands are added up pairwise, so big images
+don't lose precision and the result doesn't depend on the threads.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "color.h"
+#include "rect.h"
+
+class BufferView;
+
+namespace Stats
+{
+	struct Result
+	{
+		unsigned long long count;			// Pixels looked at.
+		Color mean;							// Black and transparent without pixels.
+		Color min, max;						// Per channel.
+		unsigned int histogram[4][256];		// Per channel, r g b a, values rounded to 8 bits.
+		unsigned long long covered;			// Pixels with some alpha.
+		unsigned long long opaque;			// Pixels with full alpha.
+		Rect bounds;						// Around the covered pixels.  No size if there are none.
+
+		Result();
+
+		// Share of the pixels with some alpha.
+		float Coverage() const { return (count) ? (float)((double)covered / count) : 0.f; }
+	};
+
+	Result Compute(const BufferView& v);
+};
@@ -0,0 +1,206 @@
+/* --------------------------------------------------------------------------
+
+tga.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Low level TGA reading and writing.
+
+-----------------------------------------------------------------------------*/
+
+#include "tga.h"
+#include <algorithm>
+#include <cstring>
+
+// Size of the blocks read from the file when decoding RLE.
+static const size_t INPUT_BLOCK = 1 << 20;
+
+TGA::Header::Header()
+	: id_length(0)
+	, colormap_type(0)
+	, image_type(NO_IMAGE)
+	, colormap_length(0)
+	, colormap_entry_size(0)
+	, width(0)
+	, height(0)
+	, bpp(0)
+	, descriptor(0)
+{
+
+}
+
+TGA::Header::Header(int w, int h, int bits, bool rle)
+	: id_length(0)
+	, colormap_type(0)
+	, image_type((rle) ? RLE_TRUE_COLOR : TRUE_COLOR)
+	, colormap_length(0)
+	, colormap_entry_size(0)
+	, width(w)
+	, height(h)
+	, bpp(bits)
+	, descriptor((unsigned char)(TOP_DOWN | ((bits == 32) ? 8 : 0)))
+{
+
+}
+
+bool TGA::ReadHeader(FILE *fp, Header &h)
+{
+	unsigned char header[18];
+
+	if (fread(header, 18, 1, fp) != 1)
+		return false;
+
+	h.id_length = header[0];
+	h.colormap_type = header[1];
+	h.image_type = header[2];
+	h.colormap_length = (((int)header[6]) << 8) + (int)header[5];
+	h.colormap_entry_size = header[7];
+	h.width = (((int)header[13]) << 8) + (int)header[12];
+	h.height = (((int)header[15]) << 8) + (int)header[14];
+	h.bpp = header[16];
+	h.descriptor = header[17];
+
+	if (h.image_type != TRUE_COLOR && h.image_type != RLE_TRUE_COLOR)
+		return false;
+
+	if (h.bpp != 24 && h.bpp != 32)
+		return false;
+
+	// Skip the image ID and a color map nobody should have put in a true color image.
+	long skip = h.id_length + ((h.colormap_type) ? h.colormap_length * ((h.colormap_entry_size + 7) >> 3) : 0);
+
+	return (skip == 0 || fseek(fp, skip, SEEK_CUR) == 0);
+}
+
+bool TGA::WriteHeader(FILE *fp, const Header &h)
+{
+	unsigned char header[18] = { h.id_length, h.colormap_type, h.image_type, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		(unsigned char)(h.width & 0x00FF), (unsigned char)(h.width >> 8),
+		(unsigned char)(h.height & 0x00FF), (unsigned char)(h.height >> 8),
+		(unsigned char)h.bpp, h.descriptor
+	};
+
+	return (fwrite(header, 18, 1, fp) == 1);
+}
+
+TGA::Reader::Reader(FILE *f, const Header &h)
+	: fp(f)
+	, header(h)
+	, pos(0)
+	, left(0)
+	, run(false)
+{
+
+}
+
+bool TGA::Reader::Fill(void *dst, size_t n)
+{
+	unsigned char *d = (unsigned char *)dst;
+
+	while (n)
+	{
+		if (pos == input.size())
+		{
+			input.resize(INPUT_BLOCK);
+			input.resize(fread(input.data(), 1, INPUT_BLOCK, fp));
+			pos = 0;
+
+			if (input.empty())
+				return false;
+		}
+
+		size_t k = std::min(n, input.size() - pos);
+		memcpy(d, &input[pos], k);
+
+		pos += k;
+		d += k;
+		n -= k;
+	}
+
+	return true;
+}
+
+bool TGA::Reader::ReadRows(unsigned char *dst, int rows)
+{
+	size_t size = header.PixelSize();
+	size_t n = (size_t)rows * header.width;
+
+	// Raw data is read in one go.
+	if (!header.IsRLE())
+		return (n == 0 || fread(dst, size * n, 1, fp) == 1);
+
+	while (n)
+	{
+		if (left == 0)
+		{
+			unsigned char packet;
+
+			if (!Fill(&packet, 1))
+				return false;
+
+			run = (packet & 0x80) != 0;
+			left = (packet & 0x7F) + 1;
+
+			if (run && !Fill(pixel, size))
+				return false;
+		}
+
+		size_t k = std::min(n, (size_t)left);
+
+		if (run)
+		{
+			for (size_t i = 0; i < k; i++, dst += size)
+				memcpy(dst, pixel, size);
+		}
+		else
+		{
+			if (!Fill(dst, k * size))
+				return false;
+
+			dst += k * size;
+		}
+
+		left -= (int)k;
+		n -= k;
+	}
+
+	return true;
+}
+
+void TGA::EncodeRow(const unsigned char *src, size_t size, size_t n, std::vector<unsigned char> &out)
+{
+	auto same = [&](size_t a, size_t b) { return memcmp(src + a * size, src + b * size, size) == 0; };
+
+	size_t i = 0;
+
+	while (i < n)
+	{
+		// Run packet for 2 or more of the same pixel.
+		size_t j = i + 1;
+
+		while (j < n && j - i < 128 && same(i, j))
+			j++;
+
+		if (j - i >= 2)
+		{
+			out.push_back((unsigned char)(0x80 | (j - i - 1)));
+			out.insert(out.end(), src + i * size, src + (i + 1) * size);
+			i = j;
+			continue;
+		}
+
+		// Raw packet up to where the next run starts.
+		j = i + 1;
+
+		while (j < n && j - i < 128 && !(j + 1 < n && same(j, j + 1)))
+			j++;
+
+		out.push_back((unsigned char)(j - i - 1));
+		out.insert(out.end(), src + i * size, src + j * size);
+		i = j;
+	}
+}
@@ -0,0 +1,84 @@
+/* --------------------------------------------------------------------------
+
+tga.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Low level TGA reading and writing: the header, and pixel rows stored raw or
+run-length encoded, moved in large blocks.  Pixels are left as they are in
+the file (BGR or BGRA); Buffer does the conversion and the orientation.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+namespace TGA
+{
+	enum ImageType { NO_IMAGE = 0, COLOR_MAPPED = 1, TRUE_COLOR = 2, GRAYSCALE = 3, RLE_COLOR_MAPPED = 9, RLE_TRUE_COLOR = 10, RLE_GRAYSCALE = 11 };
+
+	// Descriptor bits.
+	static const unsigned char RIGHT_TO_LEFT = 0x10;
+	static const unsigned char TOP_DOWN = 0x20;
+
+	struct Header
+	{
+		unsigned char id_length;
+		unsigned char colormap_type;
+		unsigned char image_type;
+		int colormap_length;
+		int colormap_entry_size;
+		int width;
+		int height;
+		int bpp;					// 24 or 32.
+		unsigned char descriptor;
+
+		Header();
+		Header(int w, int h, int bits, bool rle);
+
+		bool IsRLE() const { return image_type == RLE_TRUE_COLOR; }
+		bool IsTopDown() const { return (descriptor & TOP_DOWN) != 0; }
+		bool IsRightToLeft() const { return (descriptor & RIGHT_TO_LEFT) != 0; }
+		size_t PixelSize() const { return (size_t)bpp >> 3; }
+		size_t RowSize() const { return PixelSize() * width; }
+	};
+
+	// Reads the 18 byte header and skips the ID field and color map.  Returns
+	// false for what we don't load: color mapped, grayscale, 15/16 bits.
+	bool ReadHeader(FILE *fp, Header &h);
+	bool WriteHeader(FILE *fp, const Header &h);
+
+	// Reads rows in file order, decoding RLE packets as they come.  Packets
+	// are allowed to run across rows, as many writers do.
+	class Reader
+	{
+		FILE *fp;
+		Header header;
+
+		std::vector<unsigned char> input;	// Buffered file data for RLE.
+		size_t pos;
+
+		int left;							// Pixels left in the current packet.
+		bool run;
+		unsigned char pixel[4];				// Pixel repeated by a run packet.
+
+		bool Fill(void *dst, size_t n);
+
+	public:
+
+		Reader(FILE *f, const Header &h);
+
+		// Reads rows * width pixels into dst.
+		bool ReadRows(unsigned char *dst, int rows);
+	};
+
+	// Appends one row of n pixels of size bytes as RLE packets.  Packets never
+	// cross rows, as the specification asks.
+	void EncodeRow(const unsigned char *src, size_t size, size_t n, std::vector<unsigned char> &out);
+};
@@ -0,0 +1,185 @@
+/* --------------------------------------------------------------------------
+
+threadpool.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+A fixed set of worker threads, each with its own queue, stealing from the
+others when idle.
+
+-----------------------------------------------------------------------------*/
+
+#include "threadpool.h"
+#include <algorithm>
+#include <atomic>
+
+// The pool and queue of the worker running on this thread, if any.
+static thread_local ThreadPool *current_pool = nullptr;
+static thread_local int current_index = -1;
+
+ThreadPool::ThreadPool(int n)
+	: pending(0)
+	, deal(0)
+	, stopping(false)
+{
+	if (n <= 0)
+		n = (int)std::max(1u, std::thread::hardware_concurrency());
+
+	for (int i = 0; i < n; i++)
+		queues.emplace_back(new Queue);
+
+	for (int i = 0; i < n; i++)
+		threads.emplace_back([this, i]() { Work(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+
+	wake.notify_all();
+
+	for (auto &t : threads)
+		t.join();
+}
+
+bool ThreadPool::Pop(int index, std::function<void()> &task)
+{
+	Queue &q = *queues[index];
+	std::lock_guard<std::mutex> lock(q.mutex);
+
+	if (q.tasks.empty())
+		return false;
+
+	task = std::move(q.tasks.front());
+	q.tasks.pop_front();
+	pending--;
+
+	return true;
+}
+
+bool ThreadPool::Steal(int index, std::function<void()> &task)
+{
+	int n = (int)queues.size();
+
+	for (int k = 1; k < n; k++)
+	{
+		Queue &q = *queues[(index + k) % n];
+		std::lock_guard<std::mutex> lock(q.mutex);
+
+		if (!q.tasks.empty())
+		{
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+			pending--;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::Work(int index)
+{
+	current_pool = this;
+	current_index = index;
+
+	for (;;)
+	{
+		std::function<void()> task;
+
+		if (Pop(index, task) || Steal(index, task))
+		{
+			task();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		wake.wait(lock, [this]() { return stopping || pending > 0; });
+
+		if (stopping && pending == 0)
+			return;
+	}
+}
+
+void ThreadPool::Post(std::function<void()> task)
+{
+	bool own = (current_pool == this);
+	Queue &q = *queues[(own) ? current_index : deal++ % queues.size()];
+
+	{
+		std::lock_guard<std::mutex> lock(q.mutex);
+
+		// A worker's own tasks go first; outside tasks wait their turn.
+		if (own)
+			q.tasks.push_front(std::move(task));
+		else
+			q.tasks.push_back(std::move(task));
+
+		pending++;
+	}
+
+	// Taking the lock orders this with a worker about to sleep, so the
+	// wake up can't be missed.
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+	}
+
+	wake.notify_one();
+}
+
+void ThreadPool::For(int n, const std::function<void(int)> &fn)
+{
+	if (n <= 0)
+		return;
+
+	struct State
+	{
+		std::atomic<int> next;
+		std::atomic<int> done;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+
+	auto state = std::make_shared<State>();
+	state->next = 0;
+	state->done = 0;
+
+	// Helpers starting after the last index was taken return without
+	// touching fn, so they may outlive this call.
+	auto run = [state, n, &fn]() {
+		for (int i = state->next++; i < n; i = state->next++)
+		{
+			fn(i);
+
+			if (++state->done == n)
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				state->finished.notify_all();
+			}
+		}
+	};
+
+	int helpers = std::min(n - 1, GetSize());
+
+	for (int i = 0; i < helpers; i++)
+		Post(run);
+
+	run();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [&]() { return state->done == n; });
+}
+
+ThreadPool &ThreadPool::Shared()
+{
+	static ThreadPool pool;
+	return pool;
+}
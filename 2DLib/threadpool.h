@@ -0,0 +1,90 @@
+/* --------------------------------------------------------------------------
+
+threadpool.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+A fixed set of worker threads, each with its own queue.  Threads are started
+once instead of per operation, and everything parallel in the library shares
+ThreadPool::Shared().
+
+Tasks posted from a worker go to the front of its own queue and are run
+newest first, which keeps nested work on the core that made it.  Tasks from
+other threads are dealt out in turn.  Idle workers steal from the back of
+another worker's queue.
+
+For() has the calling thread work on its own loop.  Idle workers only help,
+so it is safe to call from inside a task, as the codecs do when they are
+run by a batch.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;		// One per thread.
+	std::vector<std::thread> threads;
+	std::atomic<int> pending;						// Tasks in all queues.
+	std::atomic<unsigned int> deal;					// Next queue for outside tasks.
+	std::mutex mutex;								// Guards sleeping and stopping.
+	std::condition_variable wake;
+	bool stopping;
+
+	bool Pop(int index, std::function<void()> &task);
+	bool Steal(int index, std::function<void()> &task);
+	void Work(int index);
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator = (const ThreadPool&);
+
+public:
+
+	// 0 threads means one per core.
+	explicit ThreadPool(int n = 0);
+
+	// Runs what is still queued, then joins the threads.
+	~ThreadPool();
+
+	int GetSize() const { return (int)threads.size(); }
+
+	// Queue a task.  It must not throw.
+	void Post(std::function<void()> task);
+
+	// Queue fn and get its result, or its exception, through a future.
+	template <class Fn>
+	auto Submit(Fn fn) -> std::future<decltype(fn())>
+	{
+		auto task = std::make_shared<std::packaged_task<decltype(fn())()>>(std::move(fn));
+		auto result = task->get_future();
+
+		Post([task]() { (*task)(); });
+		return result;
+	}
+
+	// Runs fn(0) .. fn(n - 1), in any order, and returns when all are done.
+	void For(int n, const std::function<void(int)> &fn);
+
+	// The pool the library uses, one thread per core.
+	static ThreadPool &Shared();
+};
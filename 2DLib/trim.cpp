@@ -0,0 +1,392 @@
+/* --------------------------------------------------------------------------
+
+trim.cpp
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Finding the tight bounding box of the content of a buffer.
+
+-----------------------------------------------------------------------------*/
+
+#include "trim.h"
+#include "simd.h"
+#include <algorithm>
+#include <cstring>
+
+// Row searches, one pixel at a time for any format.
+template <class F>
+struct RowSearch
+{
+	typedef typename F::Type Type;
+
+	static int First(const Type *row, int n, const Format::MaskTest<F> &test)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			if (test(row[i]))
+				return i;
+		}
+
+		return n;
+	}
+
+	static int Last(const Type *row, int n, const Format::MaskTest<F> &test)
+	{
+		for (int i = n - 1; i >= 0; i--)
+		{
+			if (test(row[i]))
+				return i;
+		}
+
+		return -1;
+	}
+};
+
+#ifdef SIMD_X86
+
+// Lowest / highest set bit of a non zero movemask.
+static inline int LowBit(int bits)
+{
+	int i = 0;
+
+	while (!(bits & 1))
+	{
+		bits >>= 1;
+		i++;
+	}
+
+	return i;
+}
+
+static inline int HighBit(int bits)
+{
+	int i = -1;
+
+	while (bits)
+	{
+		bits >>= 1;
+		i++;
+	}
+
+	return i;
+}
+
+// 4 byte pixels with alpha in the high byte: 4 per compare.
+template <class F>
+struct RowSearch4
+{
+	typedef typename F::Type Type;
+
+	// Bit i set when pixel i of the 4 at p is content.
+	static SIMD_SSE2 inline int Content(const Type *p, const Format::MaskTest<F> &test, __m128i target, __m128i alpha8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		if (test.mode == Mask::EXCEPT_COLOR)
+			return ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, target))) & 0xF;
+
+		return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_srli_epi32(v, 24), alpha8)));
+	}
+
+	static SIMD_SSE2 int First(const Type *row, int n, const Format::MaskTest<F> &test)
+	{
+		__m128i target, alpha8 = _mm_set1_epi32(test.alpha8);
+		memcpy(&target, &test.stored, 4);
+		target = _mm_shuffle_epi32(target, 0);
+
+		int i = 0;
+
+		for (; i + 4 <= n; i += 4)
+		{
+			int bits = Content(row + i, test, target, alpha8);
+
+			if (bits)
+				return i + LowBit(bits);
+		}
+
+		for (; i < n; i++)
+		{
+			if (test(row[i]))
+				return i;
+		}
+
+		return n;
+	}
+
+	static SIMD_SSE2 int Last(const Type *row, int n, const Format::MaskTest<F> &test)
+	{
+		__m128i target, alpha8 = _mm_set1_epi32(test.alpha8);
+		memcpy(&target, &test.stored, 4);
+		target = _mm_shuffle_epi32(target, 0);
+
+		int i = n;
+
+		for (; i - 4 >= 0; i -= 4)
+		{
+			int bits = Content(row + i - 4, test, target, alpha8);
+
+			if (bits)
+				return i - 4 + HighBit(bits);
+		}
+
+		for (i--; i >= 0; i--)
+		{
+			if (test(row[i]))
+				return i;
+		}
+
+		return -1;
+	}
+};
+
+template <> struct RowSearch<Format::RGBA8> : RowSearch4<Format::RGBA8> { };
+template <> struct RowSearch<Format::BGRA8> : RowSearch4<Format::BGRA8> { };
+
+// Alpha only: 16 per compare.  The target color is kept as A8 reads it back,
+// so comparing the stored bytes is exact.
+template <>
+struct RowSearch<Format::A8>
+{
+	typedef Format::MaskTest<Format::A8> Test;
+
+	static SIMD_SSE2 inline int Content(const unsigned char *p, const Test &test, __m128i target, __m128i above)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		if (test.mode == Mask::EXCEPT_COLOR)
+			return ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, target)) & 0xFFFF;
+
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, above), v));
+	}
+
+	// Whether the vector compares hold for this test: the alpha test needs
+	// alpha8 + 1 to fit in a byte.
+	static inline bool Simple(const Test &test)
+	{
+		return test.mode == Mask::EXCEPT_COLOR || (test.alpha8 >= 0 && test.alpha8 < 255);
+	}
+
+	static SIMD_SSE2 int First(const unsigned char *row, int n, const Test &test)
+	{
+		if (!Simple(test))
+			return RowSearchScalarFirst(row, n, test);
+
+		__m128i target = _mm_set1_epi8((char)test.stored), above = _mm_set1_epi8((char)(test.alpha8 + 1));
+		int i = 0;
+
+		for (; i + 16 <= n; i += 16)
+		{
+			int bits = Content(row + i, test, target, above);
+
+			if (bits)
+				return i + LowBit(bits);
+		}
+
+		return i + RowSearchScalarFirst(row + i, n - i, test);
+	}
+
+	static SIMD_SSE2 int Last(const unsigned char *row, int n, const Test &test)
+	{
+		if (!Simple(test))
+			return RowSearchScalarLast(row, n, test);
+
+		__m128i target = _mm_set1_epi8((char)test.stored), above = _mm_set1_epi8((char)(test.alpha8 + 1));
+		int i = n;
+
+		for (; i - 16 >= 0; i -= 16)
+		{
+			int bits = Content(row + i - 16, test, target, above);
+
+			if (bits)
+				return i - 16 + HighBit(bits);
+		}
+
+		return RowSearchScalarLast(row, i, test);
+	}
+
+	static int RowSearchScalarFirst(const unsigned char *row, int n, const Test &test)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			if (test(row[i]))
+				return i;
+		}
+
+		return n;
+	}
+
+	static int RowSearchScalarLast(const unsigned char *row, int n, const Test &test)
+	{
+		for (int i = n - 1; i >= 0; i--)
+		{
+			if (test(row[i]))
+				return i;
+		}
+
+		return -1;
+	}
+};
+
+// Floats: 4 pixels per compare.  Their alphas, or their per channel
+// equality masks, are transposed so each lane holds one pixel.
+template <>
+struct RowSearch<Format::RGBA32F>
+{
+	typedef Format::MaskTest<Format::RGBA32F> Test;
+
+	// Bit i set when pixel i of the 4 at p is content.
+	static SIMD_SSE2 inline int Content(const Color *p, const Test &test, __m128 target, __m128 alpha)
+	{
+		__m128 p0 = _mm_loadu_ps(&p[0].r), p1 = _mm_loadu_ps(&p[1].r);
+		__m128 p2 = _mm_loadu_ps(&p[2].r), p3 = _mm_loadu_ps(&p[3].r);
+
+		if (test.mode == Mask::EXCEPT_COLOR)
+		{
+			p0 = _mm_cmpeq_ps(p0, target);
+			p1 = _mm_cmpeq_ps(p1, target);
+			p2 = _mm_cmpeq_ps(p2, target);
+			p3 = _mm_cmpeq_ps(p3, target);
+
+			_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+
+			return ~_mm_movemask_ps(_mm_and_ps(_mm_and_ps(p0, p1), _mm_and_ps(p2, p3))) & 0xF;
+		}
+
+		// b0 b1 a0 a1 and b2 b3 a2 a3, then a0 a1 a2 a3.
+		__m128 a = _mm_movehl_ps(_mm_unpackhi_ps(p2, p3), _mm_unpackhi_ps(p0, p1));
+		return _mm_movemask_ps(_mm_cmpgt_ps(a, alpha));
+	}
+
+	static SIMD_SSE2 int First(const Color *row, int n, const Test &test)
+	{
+		__m128 target = _mm_loadu_ps(&test.target.r), alpha = _mm_set1_ps(test.alpha);
+		int i = 0;
+
+		for (; i + 4 <= n; i += 4)
+		{
+			int bits = Content(row + i, test, target, alpha);
+
+			if (bits)
+				return i + LowBit(bits);
+		}
+
+		for (; i < n; i++)
+		{
+			if (test(row[i]))
+				return i;
+		}
+
+		return n;
+	}
+
+	static SIMD_SSE2 int Last(const Color *row, int n, const Test &test)
+	{
+		__m128 target = _mm_loadu_ps(&test.target.r), alpha = _mm_set1_ps(test.alpha);
+		int i = n;
+
+		for (; i - 4 >= 0; i -= 4)
+		{
+			int bits = Content(row + i - 4, test, target, alpha);
+
+			if (bits)
+				return i - 4 + HighBit(bits);
+		}
+
+		for (i--; i >= 0; i--)
+		{
+			if (test(row[i]))
+				return i;
+		}
+
+		return -1;
+	}
+};
+
+#endif
+
+int Trim::FindFirst(const unsigned char *row, int n, PixelFormat pf, const Mask &m)
+{
+	return Format::Dispatch(pf, [&](auto f) {
+		typedef decltype(f) F;
+		return RowSearch<F>::First((const typename F::Type *)row, n, Format::MaskTest<F>(m));
+	});
+}
+
+int Trim::FindLast(const unsigned char *row, int n, PixelFormat pf, const Mask &m)
+{
+	return Format::Dispatch(pf, [&](auto f) {
+		typedef decltype(f) F;
+		return RowSearch<F>::Last((const typename F::Type *)row, n, Format::MaskTest<F>(m));
+	});
+}
+
+Rect Trim::Bounds(const unsigned char *bits, size_t stride, PixelFormat pf, const Rect &r, const Mask &m)
+{
+	return Format::Dispatch(pf, [&](auto f) {
+		typedef decltype(f) F;
+		typedef RowSearch<F> Search;
+
+		const Format::MaskTest<F> test(m);
+		const int w = r.right - r.left + 1;
+
+		auto row = [&](int y) { return (const typename F::Type *)(bits + (size_t)y * stride) + r.left; };
+
+		Rect b;
+		b.left = w;
+		b.right = -1;
+
+		// First row with content from the top, then from the bottom.
+		for (b.top = r.top; b.top <= r.bottom; b.top++)
+		{
+			b.left = Search::First(row(b.top), w, test);
+
+			if (b.left < w)
+			{
+				b.right = Search::Last(row(b.top), w, test);
+				break;
+			}
+		}
+
+		if (b.top > r.bottom)
+			return Rect(r.GetTopLeft(), Size(0, 0));
+
+		for (b.bottom = r.bottom; b.bottom > b.top; b.bottom--)
+		{
+			const auto *p = row(b.bottom);
+			int first = Search::First(p, w, test);
+
+			if (first < w)
+			{
+				b.left = std::min(b.left, first);
+				b.right = std::max(b.right, Search::Last(p, w, test));
+				break;
+			}
+		}
+
+		// Rows in between can only push the sides out: look at the margins only.
+		for (int y = b.top + 1; y < b.bottom && (b.left > 0 || b.right < w - 1); y++)
+		{
+			const auto *p = row(y);
+
+			if (b.left > 0)
+				b.left = std::min(b.left, Search::First(p, b.left, test));
+
+			if (b.right < w - 1)
+			{
+				int last = Search::Last(p + b.right + 1, w - b.right - 1, test);
+
+				if (last >= 0)
+					b.right += last + 1;
+			}
+		}
+
+		b.left += r.left;
+		b.right += r.left;
+
+		return b;
+	});
+}
@@ -0,0 +1,34 @@
+/* --------------------------------------------------------------------------
+
+trim.h
+
+This file is part of 2DLib. (C) 2016 Marc St-Jacques <marc@geekchef.com>
+
+Read COPYING for my extremely permissive and delicious licence.
+
+------
+
+Finding the tight bounding box of the content of a buffer in one row-major
+pass.  Rows are searched from the top and from the bottom for the first
+ones with content; the rows between only have their margins left of the
+leftmost and right of the rightmost content found so far looked at.  The
+row searches use SSE2 for RGBA8, BGRA8, A8 and RGBA32F.
+
+-----------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "mask.h"
+#include "rect.h"
+
+namespace Trim
+{
+	// Tight rect around the pixels of r that m counts as content, in an image
+	// of format pf with rows stride bytes apart.  r must be inside the image.
+	// When there is no content, the rect has r's top left corner and no size.
+	Rect Bounds(const unsigned char *bits, size_t stride, PixelFormat pf, const Rect &r, const Mask &m);
+
+	// Index of the first / last of n pixels m counts as content, n / -1 if none.
+	int FindFirst(const unsigned char *row, int n, PixelFormat pf, const Mask &m);
+	int FindLast(const unsigned char *row, int n, PixelFormat pf, const Mask &m);
+};